@@ -10,7 +10,7 @@ AStarAgent::AStarAgent(int agent_id, sim_params *sim_params, SpaceDiscretizer *s
     goals_reached = 0;
     goal_birth_time = *(planner->timestep);
 
-
+    restart_stream(0);
     set_pos(random_pos());
     while (planner->reserved(*(planner->timestep), cur_pos.idx, cur_pos.idy)) {
         set_pos(random_pos());
@@ -108,7 +108,21 @@ void AStarAgent::draw() {
 }
 
 SiteID AStarAgent::random_pos() {
-    return SiteID::random(sp->cells_per_side - 1, sp->cells_per_side - 1);
+    return SiteID::random(rng(), sp->cells_per_side - 1, sp->cells_per_side - 1);
+}
+
+// planner steps are 0.5 or 1 apart, so twice the timestep is a whole step count
+Random::Stream &AStarAgent::rng() {
+    uint64_t step = llround(2 * *(planner->timestep));
+    if (stream.step() != step || stream.trial() != (uint32_t)trial) {
+        stream = Random::Stream(sp->seed, trial, id, step);
+    }
+    return stream;
+}
+
+void AStarAgent::restart_stream(int trial_id) {
+    trial = trial_id;
+    stream = Random::Stream(sp->seed, trial, id, llround(2 * *(planner->timestep)));
 }
 
 void AStarAgent::set_pos(SiteID pos) {
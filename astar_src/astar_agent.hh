@@ -22,6 +22,13 @@ class AStarAgent {
     float goal_birth_time;
     radians_t travel_angle;
 
+    // random stream keyed by (sp->seed, trial, id, planner step), rekeyed on the first draw of each step
+    Random::Stream stream;
+    int trial;
+
+    // draws a reset takes when the first spot and goal are free (two per random_pos)
+    static const int RESET_DRAWS = 4;
+
     // store recent poses
     std::deque<SiteID> trail;
 
@@ -61,6 +68,11 @@ class AStarAgent {
 
     SiteID random_pos();
 
+    Random::Stream &rng();
+
+    // Start this agent's stream for a new trial (at the planner's current step)
+    void restart_stream(int trial_id);
+
     // Constructor
     AStarAgent(int agent_id, sim_params *sim_params, SpaceDiscretizer *sim_space, AStarPlanner *sim_planner);
 
@@ -4,6 +4,11 @@
 AStarManager::AStarManager(sim_params sim_params) {
     sp = sim_params;
     timestep = 0;
+    trial = 0;
+
+    // Master seed for the agents' random streams
+    if (sp.seed == 0) { sp.seed = Random::generate_seed(); }
+    if (sp.verbose) { printf("Master seed: %llu \n", (unsigned long long)sp.seed); }
 
     // Discretize space into sites
     sp.cell_width = 2.0 * sp.r_upper / sp.cells_per_side;
@@ -58,6 +63,15 @@ void AStarManager::update() {
 void AStarManager::reset() {
     timestep = 0;
     planner->reset();
+
+    // Fill every agent's stream with the draws for its first spot and goal in one batch
+    std::vector<Random::Stream *> streams;
+    for (AStarAgent *a : agents) {
+        a->restart_stream(trial);
+        streams.push_back(&a->stream);
+    }
+    Random::Stream::reserve(streams.data(), (int)streams.size(), AStarAgent::RESET_DRAWS);
+
     for (AStarAgent *a : agents) { 
         a->reset(); 
     }
@@ -81,6 +95,7 @@ void AStarManager::run_trials(int trials, double trial_length) {
 
 
 void AStarManager::run_trial(double trial_length, int trial_id) {
+    trial = trial_id;
     reset();
 
     while (timestep < trial_length) {
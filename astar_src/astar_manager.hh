@@ -31,6 +31,7 @@ class AStarManager {
     AStarPlanner *planner;
 
     float timestep;
+    int trial; // current trial, part of the key for the agents' random streams
 
     // SimulationData *sd;
     // /** Pointers to all the agents in this world. */
@@ -23,7 +23,7 @@ float AStarPlanner::dist_heuristic(SiteID a, SiteID b) {
     }
 
     if (space->periodic) {
-        Pose pose_b = nearest_periodic(Pose(a.idx, a.idy, 0, 0), Pose(b.idx, b.idy, 0, 0), space->cells_per_side / 2.0);
+        Pose2 pose_b = nearest_periodic(Pose2(a.idx, a.idy, 0), Pose2(b.idx, b.idy, 0), space->cells_per_side / 2.0);
         b = SiteID(pose_b.x, pose_b.y);
     }
 
@@ -268,7 +268,7 @@ bool AStarPlanner::is_invalid_step(SiteID cur, SiteID nbr, float cur_t, meters_t
     // wrap sensing angle if needed
     SiteID wrapped;
     if (space->periodic) {
-        Pose pose_wrapped = nearest_periodic(Pose(cur.idx, cur.idy, 0, 0), Pose(nbr.idx, nbr.idy, 0, 0), space->cells_per_side / 2.0);
+        Pose2 pose_wrapped = nearest_periodic(Pose2(cur.idx, cur.idy, 0), Pose2(nbr.idx, nbr.idy, 0), space->cells_per_side / 2.0);
         wrapped = SiteID(pose_wrapped.x, pose_wrapped.y);
     }
     else { wrapped = nbr; }
@@ -415,7 +415,7 @@ void AStarPlanner::reset() {
 
 // detect if agent senses another occupied site
 bool AStarPlanner::sensing_cone_occupied(SiteID sensing_from, radians_t a, float t, meters_t sensing_range, radians_t sensing_angle) {
-    Pose p = space->get_pos_as_pose(sensing_from);
+    Pose2 p = space->get_pos_as_pose2(sensing_from);
     if (a != -1) { p.a = a; }
 
     Node cur; // node we are currently exploring to see if it is reserved and within vision cone
@@ -433,7 +433,7 @@ bool AStarPlanner::sensing_cone_occupied(SiteID sensing_from, radians_t a, float
         visited.insert(cur.pos);
 
         for (SpaceUnit *test: space->cells[cur.pos.idx][cur.pos.idy]->neighbors) {
-            Pose test_pose = space->get_pos_as_pose(test->id);
+            Pose2 test_pose = space->get_pos_as_pose2(test->id);
             if (space->periodic) { test_pose = nearest_periodic(p, test_pose, space->space_r); }
 
             if (in_vision_cone(p, test_pose, sensing_range, sensing_angle).in_cone) {
@@ -457,7 +457,7 @@ bool AStarPlanner::sensing_cone_occupied(SiteID sensing_from, radians_t a, float
 // detect if agent senses another occupied site or is within view of another agent
 // pass in radians_t = -1 to indicate that there is no sensing direction because the agent is doing a wait step
 bool AStarPlanner::sensing_cone_invalid(SiteID sensing_from, radians_t a, float t, meters_t sensing_range, radians_t sensing_angle, bool verbose) {
-    Pose p = space->get_pos_as_pose(sensing_from);
+    Pose2 p = space->get_pos_as_pose2(sensing_from);
     if (a != -1) { p.a = a; }
 
     Node cur; // node we are currently exploring to see if it is reserved and within vision cone
@@ -476,7 +476,7 @@ bool AStarPlanner::sensing_cone_invalid(SiteID sensing_from, radians_t a, float
         visited.insert(cur.pos);
 
         for (SpaceUnit *test: space->cells[cur.pos.idx][cur.pos.idy]->neighbors) {
-            Pose test_pose = space->get_pos_as_pose(test->id);
+            Pose2 test_pose = space->get_pos_as_pose2(test->id);
             if (space->periodic) { test_pose = nearest_periodic(p, test_pose, space->space_r); }
 
             if (p.Distance(test_pose) < sensing_range) {
@@ -524,7 +524,7 @@ bool AStarPlanner::sensing_cone_invalid(SiteID sensing_from, radians_t a, float
 // pass in radians_t = -1 to indicate that there is no sensing direction because the agent is doing a wait step
 std::unordered_set<int> AStarPlanner::robots_we_block(SiteID sensing_from, float t, meters_t sensing_range, radians_t sensing_angle, bool verbose) {
     std::unordered_set<int> nbrs_we_block;
-    Pose p = space->get_pos_as_pose(sensing_from);
+    Pose2 p = space->get_pos_as_pose2(sensing_from);
 
     Node cur; // node we are currently exploring to see if it is reserved and within vision cone
 
@@ -542,7 +542,7 @@ std::unordered_set<int> AStarPlanner::robots_we_block(SiteID sensing_from, float
         visited.insert(cur.pos);
 
         for (SpaceUnit *test: space->cells[cur.pos.idx][cur.pos.idy]->neighbors) {
-            Pose test_pose = space->get_pos_as_pose(test->id);
+            Pose2 test_pose = space->get_pos_as_pose2(test->id);
             if (space->periodic) { test_pose = nearest_periodic(p, test_pose, space->space_r); }
 
             if (p.Distance(test_pose) < sensing_range) {
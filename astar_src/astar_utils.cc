@@ -146,4 +146,9 @@ void SpaceDiscretizer::cell_neighbor_helper(int idx, int idy, int nbr_idx, int n
 Pose SpaceDiscretizer::get_pos_as_pose(SiteID site_id) {
     SpaceUnit *su = cells[site_id.idx][site_id.idy];
     return Pose(su->x, su->y, 0, 0);
+}
+
+Pose2 SpaceDiscretizer::get_pos_as_pose2(SiteID site_id) {
+    SpaceUnit *su = cells[site_id.idx][site_id.idy];
+    return Pose2(su->x, su->y, 0);
 }
\ No newline at end of file
@@ -44,6 +44,7 @@ typedef struct {
     float dt; // how much to update by during each step
     int time_steps;
     bool verbose;
+    uint64_t seed = 0; // master seed for the agents' random streams; 0 picks a fresh one
 
     // for agents
     meters_t sensing_range;
@@ -90,7 +91,10 @@ class SiteID {
 
     // float l2_norm(const SiteID &s) const { return hypot(idx - s.idx, idy - s.idy); }
 
-    static SiteID random(int max_idx, int max_idy) { return SiteID(Random::get_unif_int(0, max_idx), Random::get_unif_int(0, max_idy)); }
+    static SiteID random(Random::Stream &rng, int max_idx, int max_idy) {
+        int x = rng.get_unif_int(0, max_idx);
+        return SiteID(x, rng.get_unif_int(0, max_idy));
+    }
 
     virtual void print(const char *prefix) const { printf("%s site id [x index:%i y index:%i]\n", prefix, idx, idy); }
 
@@ -171,6 +175,7 @@ class SpaceDiscretizer {
     std::vector<std::vector<SpaceUnit *>> cells;
 
     Pose get_pos_as_pose(SiteID site_id);
+    Pose2 get_pos_as_pose2(SiteID site_id); // compact version for the planner's sensing loops
 
     SpaceDiscretizer(meters_t r_upper, int u_per_side, bool periodic, bool diags);
     ~SpaceDiscretizer();
@@ -3,6 +3,17 @@
 
 #include <chrono>
 #include <random>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+// The AVX2 Philox kernel is compiled into every x86 build with GCC or Clang, and picked at run time if the CPU has AVX2
+// (builds with -march=native call it directly)
+#if !defined(MINISTAGE_SCALAR_KERNELS) && (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RANDOM_AVX2_KERNEL
+#include <immintrin.h>
+#endif
 
 // From https://www.learncpp.com/cpp-tutorial/generating-random-numbers-using-mersenne-twister/
 
@@ -50,6 +61,291 @@ namespace Random
 		std::normal_distribution<double> distribution(mean, stdev);
         return distribution(mt);
 	}
+
+	// Pick a fresh master seed for a Stream (never 0, which SimulationManager takes to mean "pick one")
+	inline uint64_t generate_seed()
+	{
+		std::random_device rd{};
+		uint64_t seed = ((uint64_t)rd() << 32) ^ rd() ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+		return seed == 0 ? 1 : seed;
+	}
+
+	// Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011)
+	// Maps a 128-bit counter and a 64-bit key to 128 random bits, with no state carried between calls
+	inline std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> ctr, std::array<uint32_t, 2> key)
+	{
+		for (int round = 0; round < 10; round++) {
+			uint64_t p0 = (uint64_t)0xD2511F53 * ctr[0];
+			uint64_t p1 = (uint64_t)0xCD9E8D57 * ctr[2];
+			ctr = { (uint32_t)(p1 >> 32) ^ ctr[1] ^ key[0], (uint32_t)p1, 
+					(uint32_t)(p0 >> 32) ^ ctr[3] ^ key[1], (uint32_t)p0 };
+			key[0] += 0x9E3779B9;
+			key[1] += 0xBB67AE85;
+		}
+		return ctr;
+	}
+
+#ifdef RANDOM_AVX2_KERNEL
+	// Whether this CPU runs AVX2 (checked once)
+	inline bool cpu_has_avx2()
+	{
+#ifdef __AVX2__
+		return true;
+#else
+		static const bool avx2 = [] { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }();
+		return avx2;
+#endif
+	}
+
+	// philox4x32_lanes for the first n - n % 8 pairs, 8 per instruction; returns how many pairs it did
+	__attribute__((target("avx2")))
+	inline int philox4x32_avx2(int n, uint32_t *c0, uint32_t *c1, uint32_t *c2, uint32_t *c3, const uint32_t *k0, const uint32_t *k1)
+	{
+		typedef __m256i lanes;
+		const int width = 8;
+		const lanes low_half = _mm256_set1_epi64x(0xFFFFFFFF);
+		const lanes m0 = _mm256_set1_epi32((int)0xD2511F53), m1 = _mm256_set1_epi32((int)0xCD9E8D57);
+		const lanes w0 = _mm256_set1_epi32((int)0x9E3779B9), w1 = _mm256_set1_epi32((int)0xBB67AE85);
+
+		int i = 0;
+		for (; i + width <= n; i += width) {
+			lanes x0 = _mm256_loadu_si256((const lanes *)(c0 + i)), x1 = _mm256_loadu_si256((const lanes *)(c1 + i));
+			lanes x2 = _mm256_loadu_si256((const lanes *)(c2 + i)), x3 = _mm256_loadu_si256((const lanes *)(c3 + i));
+			lanes key0 = _mm256_loadu_si256((const lanes *)(k0 + i)), key1 = _mm256_loadu_si256((const lanes *)(k1 + i));
+			for (int round = 0; round < 10; round++) {
+				// 32 x 32 -> 64 bit products of every lane, split into their low and high halves
+				lanes even0 = _mm256_mul_epu32(x0, m0), odd0 = _mm256_mul_epu32(_mm256_srli_epi64(x0, 32), m0);
+				lanes even1 = _mm256_mul_epu32(x2, m1), odd1 = _mm256_mul_epu32(_mm256_srli_epi64(x2, 32), m1);
+				lanes lo0 = _mm256_or_si256(_mm256_and_si256(even0, low_half), _mm256_slli_epi64(odd0, 32));
+				lanes hi0 = _mm256_or_si256(_mm256_srli_epi64(even0, 32), _mm256_andnot_si256(low_half, odd0));
+				lanes lo1 = _mm256_or_si256(_mm256_and_si256(even1, low_half), _mm256_slli_epi64(odd1, 32));
+				lanes hi1 = _mm256_or_si256(_mm256_srli_epi64(even1, 32), _mm256_andnot_si256(low_half, odd1));
+				x0 = _mm256_xor_si256(_mm256_xor_si256(hi1, x1), key0);
+				x1 = lo1;
+				x2 = _mm256_xor_si256(_mm256_xor_si256(hi0, x3), key1);
+				x3 = lo0;
+				key0 = _mm256_add_epi32(key0, w0);
+				key1 = _mm256_add_epi32(key1, w1);
+			}
+			_mm256_storeu_si256((lanes *)(c0 + i), x0);
+			_mm256_storeu_si256((lanes *)(c1 + i), x1);
+			_mm256_storeu_si256((lanes *)(c2 + i), x2);
+			_mm256_storeu_si256((lanes *)(c3 + i), x3);
+		}
+		return i;
+	}
+#endif
+
+	// philox4x32 for n (counter, key) pairs at once, given as columns: pair i is counter (c0[i], c1[i], c2[i], c3[i])
+	// and key (k0[i], k1[i]), and its block comes back in place of its counter
+	// Runs 8 pairs per instruction on CPUs with AVX2, with the same results as philox4x32
+	// (SSE2 has no gain over the scalar loop: it only multiplies two lanes at a time)
+	inline void philox4x32_lanes(int n, uint32_t *c0, uint32_t *c1, uint32_t *c2, uint32_t *c3, const uint32_t *k0, const uint32_t *k1)
+	{
+		int i = 0;
+#ifdef RANDOM_AVX2_KERNEL
+		if (n >= 8 && cpu_has_avx2()) { i = philox4x32_avx2(n, c0, c1, c2, c3, k0, k1); }
+#endif
+
+		// scalar fallback (and the remainder)
+		for (; i < n; i++) {
+			std::array<uint32_t, 4> block = philox4x32({ c0[i], c1[i], c2[i], c3[i] }, { k0[i], k1[i] });
+			c0[i] = block[0];
+			c1[i] = block[1];
+			c2[i] = block[2];
+			c3[i] = block[3];
+		}
+	}
+
+	// Layers of the ziggurat for standard normals (Marsaglia and Tsang, "The Ziggurat Method for Generating Random
+	// Variables", 2000): 256 strips of equal area under exp(-x^2 / 2), with x[i] the right edge of strip i and f[i] the
+	// density there (x[0] is the pseudo-width of the base strip, which includes the tail beyond x[1])
+	struct NormalZiggurat
+	{
+		static constexpr double R = 3.6541528853610088; // start of the tail
+		static constexpr double V = 0.00492867323399; // area of each strip
+		double x[257], f[257];
+
+		NormalZiggurat()
+		{
+			x[0] = V / std::exp(-0.5 * R * R);
+			x[1] = R;
+			for (int i = 1; i < 255; i++) { x[i + 1] = std::sqrt(-2.0 * std::log(V / x[i] + std::exp(-0.5 * x[i] * x[i]))); }
+			x[256] = 0;
+			for (int i = 0; i < 257; i++) { f[i] = std::exp(-0.5 * x[i] * x[i]); }
+		}
+	};
+	inline const NormalZiggurat normal_ziggurat;
+
+	// Random numbers keyed by (master seed, trial, agent id, step)
+	// The n-th draw from a stream is a pure function of its key and n, so agents can draw on any thread,
+	// in any order, and every run with the same master seed sees the same numbers
+	// Draws come out of a buffer of Philox blocks. reserve() fills the buffers of many streams at once with the draws
+	// their callers are about to take, in SIMD lanes, without changing what any stream hands out
+	class Stream
+	{
+	public:
+		// Most 32-bit draws a stream buffers
+		static const int CAPACITY = 16;
+
+		Stream() : Stream(0, 0, 0, 0) {}
+
+		Stream(uint64_t seed, uint32_t trial, uint32_t agent, uint64_t step)
+			: key{ (uint32_t)seed, (uint32_t)(seed >> 32) }, ctr{ 0, (uint32_t)step, agent, trial },
+			  m_trial(trial), m_agent(agent), m_step(step), used(0), avail(0) {}
+
+		uint32_t trial() const { return m_trial; }
+		uint32_t agent() const { return m_agent; }
+		uint64_t step() const { return m_step; }
+
+		// Next 32 random bits (each Philox block gives four)
+		uint32_t next_u32()
+		{
+			if (used == avail) {
+				std::array<uint32_t, 4> next = philox4x32(ctr, key);
+				std::copy(next.begin(), next.end(), block.begin());
+				ctr[0]++;
+				used = 0;
+				avail = 4;
+			}
+			return block[used++];
+		}
+
+		// Buffer at least count draws (up to CAPACITY) in each of n streams, computing all their missing blocks together
+		// Draws already buffered are kept, so every stream hands out the same numbers as without the reserve
+		static void reserve(Stream *const *streams, int n, int count)
+		{
+			const int chunk = 64; // streams per philox4x32_lanes call
+			const int max_blocks = CAPACITY / 4;
+			uint32_t c0[chunk * max_blocks], c1[chunk * max_blocks], c2[chunk * max_blocks], c3[chunk * max_blocks];
+			uint32_t k0[chunk * max_blocks], k1[chunk * max_blocks];
+			count = std::min(count, CAPACITY);
+
+			for (int first = 0; first < n; first += chunk) {
+				int last = std::min(n, first + chunk);
+
+				// the blocks missing from each stream, as consecutive columns
+				int cols = 0;
+				for (int i = first; i < last; i++) {
+					Stream &st = *streams[i];
+					if (st.avail - st.used >= count) { continue; }
+					std::copy(st.block.begin() + st.used, st.block.begin() + st.avail, st.block.begin());
+					st.avail -= st.used;
+					st.used = 0;
+					for (int b = 0; b < st.missing_blocks(count); b++) {
+						c0[cols] = st.ctr[0] + b;
+						c1[cols] = st.ctr[1];
+						c2[cols] = st.ctr[2];
+						c3[cols] = st.ctr[3];
+						k0[cols] = st.key[0];
+						k1[cols] = st.key[1];
+						cols++;
+					}
+				}
+				philox4x32_lanes(cols, c0, c1, c2, c3, k0, k1);
+
+				// hand the blocks back in the same order
+				cols = 0;
+				for (int i = first; i < last; i++) {
+					Stream &st = *streams[i];
+					if (st.avail - st.used >= count) { continue; }
+					for (int b = st.missing_blocks(count); b > 0; b--) {
+						st.block[st.avail++] = c0[cols];
+						st.block[st.avail++] = c1[cols];
+						st.block[st.avail++] = c2[cols];
+						st.block[st.avail++] = c3[cols];
+						st.ctr[0]++;
+						cols++;
+					}
+				}
+			}
+		}
+
+		// Same for this stream alone
+		void reserve(int count)
+		{
+			Stream *self = this;
+			reserve(&self, 1, count);
+		}
+
+		// Uniform double in [0, 1), with 53 random bits
+		double unif01()
+		{
+			return (next_u64() >> 11) * (1.0 / 9007199254740992.0);
+		}
+
+		// Generate a random int between [min, max] (inclusive), without modulo bias
+		int get_unif_int(int min, int max)
+		{
+			uint32_t range = (uint32_t)max - (uint32_t)min + 1;
+			if (range == 0) { return (int)next_u32(); } // the full 32-bit range
+
+			uint32_t limit = -range % range; // draws below this would favor some values
+			uint64_t m;
+			do { m = (uint64_t)next_u32() * range; } while ((uint32_t)m < limit);
+			return min + (int)(m >> 32);
+		}
+
+		// Generate a random double between [min, max)
+		double get_unif_double(double min, double max)
+		{
+			return min + (max - min) * unif01();
+		}
+
+		// Generate a normal-distributed double with prescribed mean and stdev
+		// Ziggurat: 64 random bits (two draws) and no logarithms or trig for all but about 1% of samples
+		double get_normal_double(double mean, double stdev)
+		{
+			const NormalZiggurat &z = normal_ziggurat;
+			while (true) {
+				uint64_t bits = next_u64();
+				int i = bits & 0xFF; // strip, from the low bits
+				bool negative = bits & 0x100;
+				double x = (bits >> 11) * (1.0 / 9007199254740992.0) * z.x[i]; // from the 53 high bits
+
+				if (x < z.x[i + 1]) { return mean + stdev * (negative ? -x : x); } // inside the strip's rectangle
+
+				if (i == 0) {
+					// the tail beyond R (Marsaglia's method)
+					double tail_x, tail_y;
+					do {
+						tail_x = -std::log(1.0 - unif01()) / NormalZiggurat::R;
+						tail_y = -std::log(1.0 - unif01());
+					} while (tail_y + tail_y < tail_x * tail_x);
+					x = NormalZiggurat::R + tail_x;
+					return mean + stdev * (negative ? -x : x);
+				}
+
+				// in the wedge between the rectangle and the curve
+				if (z.f[i] + (z.f[i + 1] - z.f[i]) * unif01() < std::exp(-0.5 * x * x)) {
+					return mean + stdev * (negative ? -x : x);
+				}
+			}
+		}
+
+	private:
+		std::array<uint32_t, 2> key;
+		std::array<uint32_t, 4> ctr; // (draw block, step mod 2^32, agent id, trial)
+		uint32_t m_trial, m_agent;
+		uint64_t m_step;
+
+		std::array<uint32_t, CAPACITY> block;
+		int used; // values of block already handed out
+		int avail; // values in block
+
+		// Blocks to add to the buffer for count draws, as many as fit
+		int missing_blocks(int count) const
+		{
+			int left = avail - used;
+			return std::min((count - left + 3) / 4, (CAPACITY - left) / 4);
+		}
+
+		uint64_t next_u64()
+		{
+			uint64_t high = next_u32();
+			return (high << 32) | next_u32();
+		}
+	};
 }
 
-#endif
\ No newline at end of file
+#endif
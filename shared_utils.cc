@@ -1,5 +1,9 @@
 #include "shared_utils.hh"
 
+#if !defined(MINISTAGE_SCALAR_KERNELS) && (defined(__AVX__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
+
 // FLTK Gui includes
 #include <FL/fl_draw.H>
 #include <FL/gl.h> // FLTK takes care of platform-specific GL stuff
@@ -15,14 +19,14 @@
 
 // In periodic space, find the equivalent coordinates for Pose b (so b could be translated by 2 * r_upper) closest to Pose a
 // r_upper describes 1/2 the side length of periodic space
-Pose nearest_periodic(Pose a, Pose b, meters_t r_upper) {
+Pose2 nearest_periodic(Pose2 a, Pose2 b, meters_t r_upper) {
     float dx = b.x - a.x;
     float dy = b.y - a.y;
 
     bool dx_close = fabs(dx) <= r_upper;
     bool dy_close = fabs(dy) <= r_upper;
 
-    Pose result = Pose(b.x, b.y, 0, 0);
+    Pose2 result(b.x, b.y, 0);
 
     if (dx_close && dy_close) {
         return result;
@@ -60,4 +64,567 @@ Pose nearest_periodic_slow(Pose cur_pos, Pose goal_pos, meters_t r_upper) {
 
 
 
+// Vision cone utility functions
+
+// relative tolerance used to flag candidates whose distance or angle is too close to the cone's edge to trust the fast test
+static const double CONE_EDGE_TOLERANCE = 1e-12;
+
+cone_query make_cone_query(Pose2 agent_pos, meters_t my_sensor_range, radians_t my_sensor_angle, bool periodic, meters_t r_upper) {
+    cone_query q;
+    q.pos = agent_pos;
+    q.ux = cos(agent_pos.a);
+    q.uy = sin(agent_pos.a);
+    q.cos_half = cos(my_sensor_angle / 2.0);
+    q.all_angles = my_sensor_angle / 2.0 > M_PI;
+    q.range = my_sensor_range;
+    q.sensor_angle = my_sensor_angle;
+    q.periodic = periodic;
+    q.r_upper = r_upper;
+    return q;
+}
+
+// exact (slow) test for a single candidate, used for the cases the fast test cannot settle
+static bool cone_exact(const cone_query &q, double x, double y) {
+    Pose2 nbr_pos(x, y, 0);
+    if (q.periodic) { nbr_pos = nearest_periodic(q.pos, nbr_pos, q.r_upper); }
+    return in_vision_cone(q.pos, nbr_pos, q.range, q.sensor_angle).in_cone;
+}
+
+// fast test for a single candidate: 1 if in the cone, 0 if not, 2 if too close to the edge to tell
+static inline int cone_fast(const cone_query &q, double x, double y) {
+    double dx = x - q.pos.x;
+    double dy = y - q.pos.y;
+
+    // same shift as nearest_periodic, which decides on the float-rounded offset
+    if (q.periodic) {
+        float dxf = dx;
+        float dyf = dy;
+        if (fabs(dxf) > q.r_upper) { dx = (dxf >= 0 ? x - 2 * q.r_upper : x + 2 * q.r_upper) - q.pos.x; }
+        if (fabs(dyf) > q.r_upper) { dy = (dyf >= 0 ? y - 2 * q.r_upper : y + 2 * q.r_upper) - q.pos.y; }
+    }
+
+    double d2 = dx * dx + dy * dy;
+    double r2 = q.range * q.range;
+    double dot = dx * q.ux + dy * q.uy;
+    double dot2 = dot * dot;
+    double cd2 = q.cos_half * q.cos_half * d2;
+
+    // angle to neighbor < half angle  <=>  dot > |d| cos(half angle)
+    bool in_angle = q.all_angles || (q.cos_half >= 0 ? (dot > 0 && dot2 > cd2) : (dot >= 0 || dot2 < cd2));
+    bool edge = d2 == 0 || fabs(d2 - r2) <= CONE_EDGE_TOLERANCE * r2 || 
+                (!q.all_angles && fabs(dot2 - cd2) <= CONE_EDGE_TOLERANCE * d2);
+
+    if (edge) { return 2; }
+    return (d2 < r2 && in_angle) ? 1 : 0;
+}
+
+void vision_cone_batch(const cone_query &q, const double *xs, const double *ys, int n, unsigned char *in_cone) {
+    int k = 0;
+
+#if !defined(MINISTAGE_SCALAR_KERNELS) && (defined(__AVX__) || defined(__SSE2__))
+#if defined(__AVX__)
+    // 4 candidates per iteration
+    #define CONE_LANES 4
+    typedef __m256d vec;
+    #define V_SET1 _mm256_set1_pd
+    #define V_LOAD _mm256_loadu_pd
+    #define V_ADD _mm256_add_pd
+    #define V_SUB _mm256_sub_pd
+    #define V_MUL _mm256_mul_pd
+    #define V_AND _mm256_and_pd
+    #define V_OR _mm256_or_pd
+    #define V_ANDNOT _mm256_andnot_pd
+    #define V_BLEND(a, b, mask) _mm256_blendv_pd(a, b, mask)
+    #define V_LT(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+    #define V_LE(a, b) _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+    #define V_GT(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+    #define V_GE(a, b) _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+    #define V_EQ(a, b) _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+    #define V_ROUND_TO_FLOAT(a) _mm256_cvtps_pd(_mm256_cvtpd_ps(a))
+    #define V_MOVEMASK _mm256_movemask_pd
+#else
+    // 2 candidates per iteration
+    #define CONE_LANES 2
+    typedef __m128d vec;
+    #define V_SET1 _mm_set1_pd
+    #define V_LOAD _mm_loadu_pd
+    #define V_ADD _mm_add_pd
+    #define V_SUB _mm_sub_pd
+    #define V_MUL _mm_mul_pd
+    #define V_AND _mm_and_pd
+    #define V_OR _mm_or_pd
+    #define V_ANDNOT _mm_andnot_pd
+    #define V_BLEND(a, b, mask) _mm_or_pd(_mm_andnot_pd(mask, a), _mm_and_pd(mask, b))
+    #define V_LT _mm_cmplt_pd
+    #define V_LE _mm_cmple_pd
+    #define V_GT _mm_cmpgt_pd
+    #define V_GE _mm_cmpge_pd
+    #define V_EQ _mm_cmpeq_pd
+    #define V_ROUND_TO_FLOAT(a) _mm_cvtps_pd(_mm_cvtpd_ps(a))
+    #define V_MOVEMASK _mm_movemask_pd
+#endif
+
+    const vec ax = V_SET1(q.pos.x), ay = V_SET1(q.pos.y);
+    const vec ux = V_SET1(q.ux), uy = V_SET1(q.uy);
+    const vec r2 = V_SET1(q.range * q.range);
+    const vec c2 = V_SET1(q.cos_half * q.cos_half);
+    const vec r_upper = V_SET1(q.r_upper), two_r = V_SET1(2 * q.r_upper);
+    const vec zero = V_SET1(0.0), sign_bit = V_SET1(-0.0);
+    const vec r_tol = V_SET1(CONE_EDGE_TOLERANCE * q.range * q.range), a_tol = V_SET1(CONE_EDGE_TOLERANCE);
+
+    for (; k + CONE_LANES <= n; k += CONE_LANES) {
+        vec bx = V_LOAD(xs + k);
+        vec by = V_LOAD(ys + k);
+        vec dx = V_SUB(bx, ax);
+        vec dy = V_SUB(by, ay);
+
+        if (q.periodic) {
+            // shift by -2 r_upper or +2 r_upper where the float-rounded offset is more than r_upper (as nearest_periodic)
+            vec dxf = V_ROUND_TO_FLOAT(dx);
+            vec dyf = V_ROUND_TO_FLOAT(dy);
+            vec far_x = V_GT(V_ANDNOT(sign_bit, dxf), r_upper);
+            vec far_y = V_GT(V_ANDNOT(sign_bit, dyf), r_upper);
+            vec shifted_x = V_BLEND(V_ADD(bx, two_r), V_SUB(bx, two_r), V_GE(dxf, zero));
+            vec shifted_y = V_BLEND(V_ADD(by, two_r), V_SUB(by, two_r), V_GE(dyf, zero));
+            dx = V_BLEND(dx, V_SUB(shifted_x, ax), far_x);
+            dy = V_BLEND(dy, V_SUB(shifted_y, ay), far_y);
+        }
+
+        vec d2 = V_ADD(V_MUL(dx, dx), V_MUL(dy, dy));
+        vec dot = V_ADD(V_MUL(dx, ux), V_MUL(dy, uy));
+        vec dot2 = V_MUL(dot, dot);
+        vec cd2 = V_MUL(c2, d2);
+
+        vec in_angle;
+        if (q.all_angles) { in_angle = V_EQ(zero, zero); }
+        else if (q.cos_half >= 0) { in_angle = V_AND(V_GT(dot, zero), V_GT(dot2, cd2)); }
+        else { in_angle = V_OR(V_GE(dot, zero), V_LT(dot2, cd2)); }
+
+        vec edge = V_OR(V_EQ(d2, zero), V_LE(V_ANDNOT(sign_bit, V_SUB(d2, r2)), r_tol));
+        if (!q.all_angles) { edge = V_OR(edge, V_LE(V_ANDNOT(sign_bit, V_SUB(dot2, cd2)), V_MUL(a_tol, d2))); }
+
+        int in_bits = V_MOVEMASK(V_AND(V_LT(d2, r2), in_angle));
+        int edge_bits = V_MOVEMASK(edge);
+
+        // edge cases are rare, so fill in the fast decisions first and only revisit the lanes that need it
+        for (int j = 0; j < CONE_LANES; j++) { in_cone[k + j] = (in_bits >> j) & 1; }
+        if (edge_bits) {
+            for (int j = 0; j < CONE_LANES; j++) {
+                if ((edge_bits >> j) & 1) { in_cone[k + j] = cone_exact(q, xs[k + j], ys[k + j]); }
+            }
+        }
+    }
+
+    #undef CONE_LANES
+    #undef V_SET1
+    #undef V_LOAD
+    #undef V_ADD
+    #undef V_SUB
+    #undef V_MUL
+    #undef V_AND
+    #undef V_OR
+    #undef V_ANDNOT
+    #undef V_BLEND
+    #undef V_LT
+    #undef V_LE
+    #undef V_GT
+    #undef V_GE
+    #undef V_EQ
+    #undef V_ROUND_TO_FLOAT
+    #undef V_MOVEMASK
+#endif
+
+    // scalar fallback (and the remainder of a SIMD batch)
+    for (; k < n; k++) {
+        int fast = cone_fast(q, xs[k], ys[k]);
+        in_cone[k] = fast == 2 ? cone_exact(q, xs[k], ys[k]) : fast;
+    }
+}
+
+// relative tolerance of the single precision screen, well above the float rounding in its offsets and products
+static const float CONE_EDGE_TOLERANCE_FLOAT = 1e-5f;
+// squared distances below this are left to in_vision_cone, as the float products lose their precision near underflow
+static const float CONE_MIN_D2_FLOAT = 1e-20f;
+
+void vision_cone_batch(const cone_query &q, const float *xs, const float *ys, int n, unsigned char *in_cone) {
+    int k = 0;
+
+#if !defined(MINISTAGE_SCALAR_KERNELS) && (defined(__AVX__) || defined(__SSE2__))
+#if defined(__AVX__)
+    // 8 candidates per iteration, offset in two groups of 4 doubles
+    #define CONE_LANES 8
+    #define D_LANES 4
+    typedef __m256 vec;
+    typedef __m256d dvec;
+    #define V_SET1 _mm256_set1_ps
+    #define V_LOAD _mm256_loadu_ps
+    #define V_ADD _mm256_add_ps
+    #define V_SUB _mm256_sub_ps
+    #define V_MUL _mm256_mul_ps
+    #define V_AND _mm256_and_ps
+    #define V_OR _mm256_or_ps
+    #define V_ANDNOT _mm256_andnot_ps
+    #define V_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+    #define V_LE(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+    #define V_GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+    #define V_GE(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+    #define V_EQ(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+    #define V_MOVEMASK _mm256_movemask_ps
+    #define V_FROM_DOUBLES(lo, hi) _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1)
+    #define D_SET1 _mm256_set1_pd
+    #define D_LOAD_FLOATS(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+    #define D_ADD _mm256_add_pd
+    #define D_SUB _mm256_sub_pd
+    #define D_ANDNOT _mm256_andnot_pd
+    #define D_BLEND(a, b, mask) _mm256_blendv_pd(a, b, mask)
+    #define D_GT(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+    #define D_GE(a, b) _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+    #define D_ROUND_TO_FLOAT(a) _mm256_cvtps_pd(_mm256_cvtpd_ps(a))
+#else
+    // 4 candidates per iteration, offset in two groups of 2 doubles
+    #define CONE_LANES 4
+    #define D_LANES 2
+    typedef __m128 vec;
+    typedef __m128d dvec;
+    #define V_SET1 _mm_set1_ps
+    #define V_LOAD _mm_loadu_ps
+    #define V_ADD _mm_add_ps
+    #define V_SUB _mm_sub_ps
+    #define V_MUL _mm_mul_ps
+    #define V_AND _mm_and_ps
+    #define V_OR _mm_or_ps
+    #define V_ANDNOT _mm_andnot_ps
+    #define V_LT _mm_cmplt_ps
+    #define V_LE _mm_cmple_ps
+    #define V_GT _mm_cmpgt_ps
+    #define V_GE _mm_cmpge_ps
+    #define V_EQ _mm_cmpeq_ps
+    #define V_MOVEMASK _mm_movemask_ps
+    #define V_FROM_DOUBLES(lo, hi) _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi))
+    #define D_SET1 _mm_set1_pd
+    #define D_LOAD_FLOATS(p) _mm_cvtps_pd(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(p)))
+    #define D_ADD _mm_add_pd
+    #define D_SUB _mm_sub_pd
+    #define D_ANDNOT _mm_andnot_pd
+    #define D_BLEND(a, b, mask) _mm_or_pd(_mm_andnot_pd(mask, a), _mm_and_pd(mask, b))
+    #define D_GT _mm_cmpgt_pd
+    #define D_GE _mm_cmpge_pd
+    #define D_ROUND_TO_FLOAT(a) _mm_cvtps_pd(_mm_cvtpd_ps(a))
+#endif
+
+    // Offsets from the query agent must carry float rounding relative to their own size, however near the neighbor.
+    // A float subtraction gives that directly when the query agent sits at a float position (as it does when read from
+    // a single precision store) and there is no periodic shift; otherwise offsets are taken in double, shifted to the
+    // nearest periodic image exactly as in the double kernel, and only then rounded to float.
+    // The products and comparisons that follow run at full float width.
+    bool float_offsets = !q.periodic && (float)q.pos.x == q.pos.x && (float)q.pos.y == q.pos.y;
+    const vec fax = V_SET1(q.pos.x), fay = V_SET1(q.pos.y);
+    const dvec ax = D_SET1(q.pos.x), ay = D_SET1(q.pos.y);
+    const dvec r_upper = D_SET1(q.r_upper), two_r = D_SET1(2 * q.r_upper);
+    const dvec dzero = D_SET1(0.0), dsign_bit = D_SET1(-0.0);
+
+    auto offsets = [&](const float *px, const float *py, dvec &dx, dvec &dy) {
+        dvec bx = D_LOAD_FLOATS(px);
+        dvec by = D_LOAD_FLOATS(py);
+        dx = D_SUB(bx, ax);
+        dy = D_SUB(by, ay);
+
+        if (q.periodic) {
+            dvec dxf = D_ROUND_TO_FLOAT(dx);
+            dvec dyf = D_ROUND_TO_FLOAT(dy);
+            dvec far_x = D_GT(D_ANDNOT(dsign_bit, dxf), r_upper);
+            dvec far_y = D_GT(D_ANDNOT(dsign_bit, dyf), r_upper);
+            dvec shifted_x = D_BLEND(D_ADD(bx, two_r), D_SUB(bx, two_r), D_GE(dxf, dzero));
+            dvec shifted_y = D_BLEND(D_ADD(by, two_r), D_SUB(by, two_r), D_GE(dyf, dzero));
+            dx = D_BLEND(dx, D_SUB(shifted_x, ax), far_x);
+            dy = D_BLEND(dy, D_SUB(shifted_y, ay), far_y);
+        }
+    };
+
+    const vec ux = V_SET1(q.ux), uy = V_SET1(q.uy);
+    const vec r2 = V_SET1(q.range * q.range);
+    const vec c2 = V_SET1(q.cos_half * q.cos_half);
+    const vec zero = V_SET1(0.0f), sign_bit = V_SET1(-0.0f), min_d2 = V_SET1(CONE_MIN_D2_FLOAT);
+    const vec r_tol = V_SET1(CONE_EDGE_TOLERANCE_FLOAT * q.range * q.range), a_tol = V_SET1(CONE_EDGE_TOLERANCE_FLOAT);
+
+    for (; k + CONE_LANES <= n; k += CONE_LANES) {
+        vec dx, dy;
+        if (float_offsets) {
+            dx = V_SUB(V_LOAD(xs + k), fax);
+            dy = V_SUB(V_LOAD(ys + k), fay);
+        }
+        else {
+            dvec dx_lo, dy_lo, dx_hi, dy_hi;
+            offsets(xs + k, ys + k, dx_lo, dy_lo);
+            offsets(xs + k + D_LANES, ys + k + D_LANES, dx_hi, dy_hi);
+            dx = V_FROM_DOUBLES(dx_lo, dx_hi);
+            dy = V_FROM_DOUBLES(dy_lo, dy_hi);
+        }
+
+        vec d2 = V_ADD(V_MUL(dx, dx), V_MUL(dy, dy));
+        vec dot = V_ADD(V_MUL(dx, ux), V_MUL(dy, uy));
+        vec dot2 = V_MUL(dot, dot);
+        vec cd2 = V_MUL(c2, d2);
+
+        vec in_angle;
+        if (q.all_angles) { in_angle = V_EQ(zero, zero); }
+        else if (q.cos_half >= 0) { in_angle = V_AND(V_GT(dot, zero), V_GT(dot2, cd2)); }
+        else { in_angle = V_OR(V_GE(dot, zero), V_LT(dot2, cd2)); }
+
+        vec edge = V_OR(V_LT(d2, min_d2), V_LE(V_ANDNOT(sign_bit, V_SUB(d2, r2)), r_tol));
+        if (!q.all_angles) { edge = V_OR(edge, V_LE(V_ANDNOT(sign_bit, V_SUB(dot2, cd2)), V_MUL(a_tol, d2))); }
+
+        int in_bits = V_MOVEMASK(V_AND(V_LT(d2, r2), in_angle));
+        int edge_bits = V_MOVEMASK(edge);
+
+        // edge cases are rare, so fill in the fast decisions first and only revisit the lanes that need it
+        for (int j = 0; j < CONE_LANES; j++) { in_cone[k + j] = (in_bits >> j) & 1; }
+        if (edge_bits) {
+            for (int j = 0; j < CONE_LANES; j++) {
+                if ((edge_bits >> j) & 1) { in_cone[k + j] = cone_exact(q, xs[k + j], ys[k + j]); }
+            }
+        }
+    }
+
+    #undef CONE_LANES
+    #undef D_LANES
+    #undef V_SET1
+    #undef V_LOAD
+    #undef V_ADD
+    #undef V_SUB
+    #undef V_MUL
+    #undef V_AND
+    #undef V_OR
+    #undef V_ANDNOT
+    #undef V_LT
+    #undef V_LE
+    #undef V_GT
+    #undef V_GE
+    #undef V_EQ
+    #undef V_MOVEMASK
+    #undef V_FROM_DOUBLES
+    #undef D_SET1
+    #undef D_LOAD_FLOATS
+    #undef D_ADD
+    #undef D_SUB
+    #undef D_ANDNOT
+    #undef D_BLEND
+    #undef D_GT
+    #undef D_GE
+    #undef D_ROUND_TO_FLOAT
+#endif
+
+    // scalar fallback (and the remainder of a SIMD batch), in double
+    for (; k < n; k++) {
+        int fast = cone_fast(q, xs[k], ys[k]);
+        in_cone[k] = fast == 2 ? cone_exact(q, xs[k], ys[k]) : fast;
+    }
+}
+
+// Steering kernel
+
+#if !defined(MINISTAGE_SCALAR_KERNELS) && (defined(__AVX__) || defined(__SSE2__))
+#if defined(__AVX__)
+// 4 agents per iteration
+#define STEER_LANES 4
+typedef __m256d steer_vec;
+static inline steer_vec steer_load(const double *p) { return _mm256_loadu_pd(p); }
+static inline steer_vec steer_load(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+static inline void steer_store(double *p, steer_vec v) { _mm256_storeu_pd(p, v); }
+static inline void steer_store(float *p, steer_vec v) { _mm_storeu_ps(p, _mm256_cvtpd_ps(v)); }
+static inline steer_vec steer_flags(const char *p) { return _mm256_cmp_pd(_mm256_set_pd(p[3], p[2], p[1], p[0]), _mm256_setzero_pd(), _CMP_NEQ_UQ); }
+#define S_SET1 _mm256_set1_pd
+#define S_ADD _mm256_add_pd
+#define S_SUB _mm256_sub_pd
+#define S_MUL _mm256_mul_pd
+#define S_DIV _mm256_div_pd
+#define S_ANDNOT _mm256_andnot_pd
+#define S_OR _mm256_or_pd
+#define S_BLEND(a, b, mask) _mm256_blendv_pd(a, b, mask)
+#define S_LT(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define S_LE(a, b) _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+#define S_GT(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define S_MOVEMASK _mm256_movemask_pd
+#else
+// 2 agents per iteration
+#define STEER_LANES 2
+typedef __m128d steer_vec;
+static inline steer_vec steer_load(const double *p) { return _mm_loadu_pd(p); }
+static inline steer_vec steer_load(const float *p) { return _mm_set_pd(p[1], p[0]); }
+static inline void steer_store(double *p, steer_vec v) { _mm_storeu_pd(p, v); }
+static inline void steer_store(float *p, steer_vec v) { _mm_storel_pi((__m64 *)p, _mm_cvtpd_ps(v)); }
+static inline steer_vec steer_flags(const char *p) { return _mm_cmpneq_pd(_mm_set_pd(p[1], p[0]), _mm_setzero_pd()); }
+#define S_SET1 _mm_set1_pd
+#define S_ADD _mm_add_pd
+#define S_SUB _mm_sub_pd
+#define S_MUL _mm_mul_pd
+#define S_DIV _mm_div_pd
+#define S_ANDNOT _mm_andnot_pd
+#define S_OR _mm_or_pd
+#define S_BLEND(a, b, mask) _mm_or_pd(_mm_andnot_pd(mask, a), _mm_and_pd(mask, b))
+#define S_LT _mm_cmplt_pd
+#define S_LE _mm_cmple_pd
+#define S_GT _mm_cmpgt_pd
+#define S_MOVEMASK _mm_movemask_pd
+#endif
+#endif
+
+template <typename T>
+static void steer_batch_lanes(const steer_params &p, const T *travel_angle, const T *heading, const char *stop, int *phase_count,
+                              T *fwd_speed, T *turn_speed, int n) {
+    int k = 0;
+
+#if !defined(MINISTAGE_SCALAR_KERNELS) && (defined(__AVX__) || defined(__SSE2__))
+    const steer_vec pi = S_SET1(M_PI), minus_pi = S_SET1(-M_PI), two_pi = S_SET1(2.0 * M_PI);
+    const steer_vec lined_up = S_SET1(M_PI / 20), full_turn = S_SET1(M_PI / 10);
+    const steer_vec cruisespeed = S_SET1(p.cruisespeed), turnspeed = S_SET1(p.turnspeed), sign_bit = S_SET1(-0.0);
+
+    for (; k + STEER_LANES <= n; k += STEER_LANES) {
+        steer_vec a_error = S_SUB(steer_load(travel_angle + k), steer_load(heading + k));
+
+        // normalize: the same steps of 2 pi as the scalar loops, for as long as any lane needs one
+        for (steer_vec low = S_LE(a_error, minus_pi); S_MOVEMASK(low); low = S_LE(a_error, minus_pi)) {
+            a_error = S_BLEND(a_error, S_ADD(a_error, two_pi), low);
+        }
+        for (steer_vec high = S_GT(a_error, pi); S_MOVEMASK(high); high = S_GT(a_error, pi)) {
+            a_error = S_BLEND(a_error, S_SUB(a_error, two_pi), high);
+        }
+        steer_vec abs_a_error = S_ANDNOT(sign_bit, a_error);
+
+        // full turn speed until close to the travel angle (lanes with no error divide 0 by 0, but take the other branch)
+        if (!p.instant_turn) {
+            steer_vec full = S_MUL(turnspeed, S_DIV(a_error, abs_a_error));
+            steer_store(turn_speed + k, S_BLEND(S_MUL(turnspeed, a_error), full, S_GT(abs_a_error, full_turn)));
+        }
+
+        // no forward motion while stopped or turning
+        steer_vec held = S_OR(steer_flags(stop + k), S_GT(abs_a_error, lined_up));
+        steer_store(fwd_speed + k, S_ANDNOT(held, cruisespeed));
+
+        int aligned = S_MOVEMASK(S_LT(abs_a_error, lined_up));
+        for (int j = 0; j < STEER_LANES; j++) { phase_count[k + j] += ((aligned >> j) & 1) | (phase_count[k + j] == 0); }
+    }
+#endif
+
+    // scalar fallback (and the remainder of a SIMD batch)
+    for (; k < n; k++) {
+        double a_error = normalize((double)travel_angle[k] - (double)heading[k]);
+        double abs_a_error = std::fabs(a_error);
+        if (!p.instant_turn) {
+            turn_speed[k] = abs_a_error > M_PI / 10 ? p.turnspeed * (a_error / abs_a_error) : p.turnspeed * a_error;
+        }
+        fwd_speed[k] = (stop[k] || abs_a_error > M_PI / 20) ? 0 : p.cruisespeed;
+        if (abs_a_error < M_PI / 20 || phase_count[k] == 0) { phase_count[k]++; }
+    }
+}
+
+#if !defined(MINISTAGE_SCALAR_KERNELS) && (defined(__AVX__) || defined(__SSE2__))
+#undef STEER_LANES
+#undef S_SET1
+#undef S_ADD
+#undef S_SUB
+#undef S_MUL
+#undef S_DIV
+#undef S_ANDNOT
+#undef S_OR
+#undef S_BLEND
+#undef S_LT
+#undef S_LE
+#undef S_GT
+#undef S_MOVEMASK
+#endif
+
+void steer_batch(const steer_params &p, const double *travel_angle, const double *heading, const char *stop, int *phase_count,
+                 double *fwd_speed, double *turn_speed, int n) {
+    steer_batch_lanes(p, travel_angle, heading, stop, phase_count, fwd_speed, turn_speed, n);
+}
+
+void steer_batch(const steer_params &p, const float *travel_angle, const float *heading, const char *stop, int *phase_count,
+                 float *fwd_speed, float *turn_speed, int n) {
+    steer_batch_lanes(p, travel_angle, heading, stop, phase_count, fwd_speed, turn_speed, n);
+}
+
+
+// check vision_cone_batch against in_vision_cone on random and edge-of-cone cases (see simulation_scripts/test_vision_cone.cc)
+bool vision_cone_batch_agrees(int num_tests, bool periodic, bool single_precision) {
+    const char* redText = "\033[1;31m";
+    const char* resetText = "\033[0m";
+    const int batch = 37; // not a multiple of the SIMD width, so the scalar remainder is tested too
+    bool agree = true;
+
+    for (int t = 0; t < num_tests; t++) {
+        meters_t r_upper = Random::get_unif_double(1, 20);
+        meters_t range = Random::get_unif_double(0.05, 1.5) * std::min(r_upper, 2.0);
+        radians_t angle = Random::get_unif_double(0, 2.5 * M_PI);
+        Pose2 agent_pos(Random::get_unif_double(-r_upper, r_upper), Random::get_unif_double(-r_upper, r_upper), 
+                        Random::get_unif_double(-2 * M_PI, 2 * M_PI));
+
+        double xs[batch], ys[batch];
+        for (int k = 0; k < batch; k++) {
+            double dist, dir;
+            switch (k % 4) {
+                case 0: // exactly on the edge of the range
+                    dist = range;
+                    dir = agent_pos.a + Random::get_unif_double(-angle / 2, angle / 2);
+                    break;
+                case 1: // exactly on an edge of the cone's angle
+                    dist = Random::get_unif_double(0, range);
+                    dir = agent_pos.a + (k % 8 == 1 ? angle / 2 : -angle / 2);
+                    break;
+                case 2: // on top of the agent
+                    dist = 0;
+                    dir = 0;
+                    break;
+                default: // anywhere nearby
+                    dist = Random::get_unif_double(0, 2 * range);
+                    dir = Random::get_unif_double(-M_PI, M_PI);
+            }
+            xs[k] = agent_pos.x + dist * cos(dir);
+            ys[k] = agent_pos.y + dist * sin(dir);
+
+            // wrap back into the periodic arena so nearest_periodic has work to do
+            if (periodic) {
+                if (xs[k] > r_upper) { xs[k] -= 2 * r_upper; }
+                if (xs[k] < -r_upper) { xs[k] += 2 * r_upper; }
+                if (ys[k] > r_upper) { ys[k] -= 2 * r_upper; }
+                if (ys[k] < -r_upper) { ys[k] += 2 * r_upper; }
+            }
+        }
+
+        unsigned char in_cone[batch];
+        if (!single_precision) {
+            cone_query q = make_cone_query(agent_pos, range, angle, periodic, r_upper);
+            vision_cone_batch(q, xs, ys, batch, in_cone);
+
+            for (int k = 0; k < batch; k++) {
+                if ((bool)in_cone[k] != cone_exact(q, xs[k], ys[k])) {
+                    printf("%sVision cone kernel disagrees with in_vision_cone at agent %s, neighbor [%.17g %.17g]%s\n", 
+                        redText, agent_pos.to_pose().String().c_str(), xs[k], ys[k], resetText);
+                    agree = false;
+                }
+            }
+            continue;
+        }
+
+        // with the agent and its neighbors rounded to floats as a float store holds them
+        Pose2 agent_pos_f((float)agent_pos.x, (float)agent_pos.y, (float)agent_pos.a);
+        cone_query qf = make_cone_query(agent_pos_f, range, angle, periodic, r_upper);
+        float xsf[batch], ysf[batch];
+        for (int k = 0; k < batch; k++) {
+            xsf[k] = xs[k];
+            ysf[k] = ys[k];
+        }
+        vision_cone_batch(qf, xsf, ysf, batch, in_cone);
+
+        for (int k = 0; k < batch; k++) {
+            if ((bool)in_cone[k] != cone_exact(qf, xsf[k], ysf[k])) {
+                printf("%sSingle precision vision cone kernel disagrees with in_vision_cone at agent %s, neighbor [%.9g %.9g]%s\n", 
+                    redText, agent_pos_f.to_pose().String().c_str(), xsf[k], ysf[k], resetText);
+                agree = false;
+            }
+        }
+    }
+
+    return agree;
+}
 
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <vector>
 #include <set>
+#include <type_traits>
 #include "random.hh"
 #include <stdexcept>
 
@@ -29,6 +30,14 @@ typedef double meters_t;
 /** Radians: unit of angle */
 typedef double radians_t;
 
+/** Storage type of the agents' positions, headings and speeds: float in a MINISTAGE_FLOAT32 build, which halves the
+ * memory streamed by the sensing and moving loops (arithmetic on stored values is still done in double) */
+#ifdef MINISTAGE_FLOAT32
+typedef float real_t;
+#else
+typedef double real_t;
+#endif
+
 
 // Utility Functions
 /** Normalize an angle to within +/_ M_PI. */
@@ -142,9 +151,45 @@ class Pose {
     meters_t Distance(const Pose &other) const { return hypot(x - other.x, y - other.y); }
 };
 
+
+/// Compact 2D pose (x, y and heading) for the hot paths of both engines
+/** Trivially copyable with no vtable or z, so it is 24 bytes and fits in registers. 
+Pose is kept for the GUI and public interfaces; convert with Pose2(pose) and to_pose(). */
+struct Pose2 {
+    meters_t x, y; ///< location
+    radians_t a; ///< heading
+
+    Pose2() : x(0.0), y(0.0), a(0.0) {}
+
+    Pose2(meters_t x, meters_t y, radians_t a) : x(x), y(y), a(a) {}
+
+    explicit Pose2(const Pose &p) : x(p.x), y(p.y), a(p.a) {}
+
+    Pose to_pose() const { return Pose(x, y, 0, a); }
+
+    // Add motion using local angle, as Pose::operator+
+    inline Pose2 operator+(const Pose2 &p) const
+    {
+        const double cosa = cos(a);
+        const double sina = sin(a);
+
+        return Pose2(x + p.x * cosa - p.y * sina, y + p.x * sina + p.y * cosa, normalize(a + p.a));
+    }
+
+    meters_t Distance(const Pose2 &other) const { return hypot(x - other.x, y - other.y); }
+};
+
+static_assert(std::is_trivially_copyable<Pose2>::value && sizeof(Pose2) == 3 * sizeof(meters_t), 
+              "Pose2 should stay a plain 2D pose");
+
+
 // In periodic space, find the equivalent coordinates for Pose b (so b could be translated by 2 * r_upper) closest to Pose a
 // r_upper describes 1/2 the side length of periodic space
-Pose nearest_periodic(Pose a, Pose b, meters_t r_upper);
+Pose2 nearest_periodic(Pose2 a, Pose2 b, meters_t r_upper);
+
+inline Pose nearest_periodic(Pose a, Pose b, meters_t r_upper) {
+    return nearest_periodic(Pose2(a), Pose2(b), r_upper).to_pose();
+}
 
 // slower implementation of nearest_periodic function, kept for testing purposes
 Pose nearest_periodic_slow(Pose cur_pos, Pose goal_pos, meters_t r_upper);
@@ -156,6 +201,10 @@ inline void coord_shift(double x, double y, double z, double a) {
     glRotatef(rtod(a), 0, 0, 1);
 }
 
+inline void pose_shift(const Pose2 &pose) {
+    coord_shift(pose.x, pose.y, 0, pose.a);
+}
+
 inline void pose_shift(const Pose &pose) {
     coord_shift(pose.x, pose.y, pose.z, pose.a);
 }
@@ -171,7 +220,7 @@ typedef struct {
 } cone_result;
 
 // need to be strictly within the sensing range
-inline cone_result in_vision_cone(Pose agent_pos, Pose nbr_pos, meters_t my_sensor_range, radians_t my_sensor_angle) {
+inline cone_result in_vision_cone(Pose2 agent_pos, Pose2 nbr_pos, meters_t my_sensor_range, radians_t my_sensor_angle) {
     cone_result result;
     
     double dx = nbr_pos.x - agent_pos.x;
@@ -185,6 +234,56 @@ inline cone_result in_vision_cone(Pose agent_pos, Pose nbr_pos, meters_t my_sens
     return result;
 }
 
+inline cone_result in_vision_cone(const Pose &agent_pos, const Pose &nbr_pos, meters_t my_sensor_range, radians_t my_sensor_angle) {
+    return in_vision_cone(Pose2(agent_pos), Pose2(nbr_pos), my_sensor_range, my_sensor_angle);
+}
+
+
+// Per-agent constants for vision_cone_batch, computed once for each sensing agent
+typedef struct {
+    Pose2 pos;
+    double ux, uy; // unit vector along the agent's heading
+    double cos_half; // cosine of half the sensor angle
+    bool all_angles; // half the sensor angle is more than pi, so every direction is in view
+    meters_t range;
+    radians_t sensor_angle;
+    bool periodic; // shift candidates to their nearest periodic image first
+    meters_t r_upper;
+} cone_query;
+
+cone_query make_cone_query(Pose2 agent_pos, meters_t my_sensor_range, radians_t my_sensor_angle, bool periodic, meters_t r_upper);
+
+// Batched, trig-free version of in_vision_cone (after nearest_periodic if the query is periodic)
+// Tests the query agent against n candidates at (xs[k], ys[k]) and sets in_cone[k] to 1 for those in its vision cone
+// Squared distance and the heading dot product replace hypot and atan2, using AVX or SSE2 where the build allows;
+// candidates within rounding error of the cone's edge are settled by in_vision_cone itself, so the decisions match it exactly
+void vision_cone_batch(const cone_query &q, const double *xs, const double *ys, int n, unsigned char *in_cone);
+
+// Same decisions for candidates stored in single precision: the products and comparisons run in float, twice as many
+// per SIMD instruction, with a wider edge tolerance so the edge cases are still settled by in_vision_cone
+void vision_cone_batch(const cone_query &q, const float *xs, const float *ys, int n, unsigned char *in_cone);
+
+// check the double (or single precision) vision_cone_batch against in_vision_cone on random and edge-of-cone cases,
+// in a periodic or bounded arena (run by simulation_scripts/test_vision_cone.cc)
+bool vision_cone_batch_agrees(int num_tests, bool periodic, bool single_precision);
+
+
+// Per-run constants for steer_batch
+typedef struct {
+    double cruisespeed;
+    double turnspeed; // radians per second, unused with instant turning
+    bool instant_turn; // leave the turning speeds alone
+} steer_params;
+
+// Batched steering of run-and-tumble agents from their state arrays: for each agent k, the heading error
+// normalize(travel_angle[k] - heading[k]) sets its forward speed (cruisespeed, or 0 if stopped or not lined up yet)
+// and turning speed, and its run phase count goes up if it is lined up or has only just started the phase (count 0)
+// Same arithmetic as AgentEngine::steer and decision_update, lane by lane, using AVX or SSE2 where the build allows
+void steer_batch(const steer_params &p, const double *travel_angle, const double *heading, const char *stop, int *phase_count,
+                 double *fwd_speed, double *turn_speed, int n);
+void steer_batch(const steer_params &p, const float *travel_angle, const float *heading, const char *stop, int *phase_count,
+                 float *fwd_speed, float *turn_speed, int n);
+
 
 // Color class
 class Color {
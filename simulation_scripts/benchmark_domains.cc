@@ -0,0 +1,86 @@
+// Times the full step (sensing, decisions and moves of the Fig. 2 run-and-tumble robots) of large periodic worlds
+// at the density of Fig. 2 (256 robots in a 40 m box), with the step split across threads either by equal blocks of
+// agents or by domain decomposition (sp.domain_decomposition: one strip of the arena per thread)
+// usage: benchmark_domains [max_threads] [steps]
+// (max_threads defaults to the number of hardware threads; thread counts double from 1 up to it)
+
+#include <chrono>
+#include <thread>
+#include "simulation_manager.hh"
+
+
+// Seconds per step of a world with n robots on the given number of threads
+static double time_step(int n, int threads, bool domains, int steps) {
+    sim_params sp;
+    sp.num_agents = n;
+    sp.periodic = true;
+    sp.circle_arena = false;
+    sp.r_upper = 20 * sqrt(n / 256.0); // same density as 256 robots in Fig. 2
+    sp.r_lower = 0;
+    sp.anglenoise = 1.0;
+    sp.anglebias = 0;
+    sp.noise_prob = 1.0;
+    sp.conditional_noise = false;
+    sp.sensing_angle = M_PI * 2.0 / 3.0;
+    sp.sensing_range = 2;
+    sp.cells_range = sp.r_upper;
+    sp.cells_per_side = floor(2.0 * sp.cells_range / sp.sensing_range);
+    sp.cell_width = 2.0 * sp.cells_range / sp.cells_per_side;
+    sp.use_sorted_agents = false;
+    sp.use_cell_lists = true;
+    sp.incremental_cell_lists = true;
+    sp.use_cone_stencil = true;
+    sp.avg_runsteps = 10;
+    sp.randomize_runsteps = true;
+    sp.turnspeed = -1;
+    sp.cruisespeed = 0.5;
+    sp.dt = .1;
+    sp.goal_tolerance = 0.6;
+    sp.num_threads = threads;
+    sp.domain_decomposition = domains;
+    sp.seed = 1;
+    sp.gui_speedup = 1;
+    sp.gui_zoom = 1;
+    sp.gui_draw_cells = false;
+    sp.gui_draw_footprints = false;
+    sp.gui_random_colors = false;
+    sp.save_data_interval = 0;
+    sp.verbose = false;
+
+    SimulationManager sim(sp);
+    sim.update(); // first step out of the timing
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < steps; t++) { sim.update(); }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count() / steps;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    int steps = argc > 2 ? atoi(argv[2]) : 20;
+
+    printf("%-8s %-8s %12s %12s %12s %12s   (ms per step, speedup over 1 thread)\n", "agents", "threads", "blocks", "speedup",
+           "domains", "speedup");
+
+    for (int n : {100000, 1000000}) {
+        double serial = 0;
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            double blocks = time_step(n, threads, false, steps);
+            if (threads == 1) { serial = blocks; }
+            printf("%-8d %-8d %12.1f %12.2f", n, threads, 1000 * blocks, serial / blocks);
+
+            // domain decomposition needs more than one thread
+            if (threads > 1) {
+                double domains = time_step(n, threads, true, steps);
+                printf(" %12.1f %12.2f", 1000 * domains, serial / domains);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
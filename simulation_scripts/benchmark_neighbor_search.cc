@@ -0,0 +1,137 @@
+// Times the neighbor search settings (sorted agents, hashed and fixed cell lists, k-d tree, Verlet lists) on uniform and crowded
+// layouts of agents, to show when each pays off
+// Each step jitters every agent a little, updates the search structures and senses every agent (full sensed lists),
+// without any agent behavior, so only the neighbor search is measured
+// Agents are placed in random order; the "/sfc" settings renumber the agent store along a Morton curve of cells
+// (sp.renumber_interval), so agents sensed one after another, and their neighbors, sit close in memory
+
+#include <chrono>
+#include <random>
+#include "simulation_manager.hh"
+
+
+struct search_setting {
+    const char *name;
+    bool sorted, cells, kd, verlet;
+    meters_t cells_range; // fixed grid's coordinate range, as a fraction of r_upper (0 for hashed cells)
+    bool renumber; // renumber the agent store along a Morton curve of cells
+    int max_agents; // skip the setting for more agents than this, once it gets slow
+};
+
+// Steps between renumberings, for the settings that renumber
+static const int RENUMBER_INTERVAL = 10;
+
+// Lay out n agents in the square [-r_upper, r_upper]^2: uniformly, or with most of them packed into a few jams
+static void place_agents(AgentStore &s, int n, meters_t r_upper, bool crowded, std::mt19937 &gen) {
+    std::uniform_real_distribution<double> uniform(-r_upper, r_upper);
+    std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+    std::normal_distribution<double> jam(0, 0.5);
+    int num_jams = 8;
+    std::vector<double> jam_x, jam_y;
+    for (int j = 0; j < num_jams; j++) {
+        jam_x.push_back(uniform(gen) * 0.8);
+        jam_y.push_back(uniform(gen) * 0.8);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (crowded && i % 10 != 0) {
+            int j = i % num_jams;
+            s.x[i] = std::max(-r_upper, std::min(r_upper, jam_x[j] + jam(gen)));
+            s.y[i] = std::max(-r_upper, std::min(r_upper, jam_y[j] + jam(gen)));
+        }
+        else {
+            s.x[i] = uniform(gen);
+            s.y[i] = uniform(gen);
+        }
+        s.a[i] = angle(gen);
+    }
+}
+
+// Seconds per step for one setting
+static double time_setting(const search_setting &setting, int n, bool crowded, int steps) {
+    sim_params sp;
+    sp.num_agents = n;
+    sp.periodic = false;
+    sp.circle_arena = false;
+    sp.r_upper = sqrt(n / 2.0) / 2; // 2 agents per square meter on average
+    sp.r_lower = 0;
+    sp.sensing_range = 0.6;
+    sp.sensing_angle = M_PI * 2.0 / 3.0;
+    sp.hashed_cell_lists = setting.cells_range == 0;
+    sp.cells_range = setting.cells_range * sp.r_upper;
+    sp.cells_per_side = floor(2.0 * sp.cells_range / sp.sensing_range);
+    sp.cell_width = sp.hashed_cell_lists ? sp.sensing_range : 2.0 * sp.cells_range / sp.cells_per_side;
+    sp.use_sorted_agents = setting.sorted;
+    sp.use_cell_lists = setting.cells;
+    sp.incremental_cell_lists = setting.cells;
+    sp.use_cone_stencil = setting.cells;
+    sp.use_kd_tree = setting.kd;
+    sp.use_verlet_lists = setting.verlet;
+    sp.renumber_interval = setting.renumber ? RENUMBER_INTERVAL : 0;
+    sp.dt = 0.1;
+    sp.verbose = false;
+
+    std::mt19937 gen(1);
+    std::normal_distribution<double> jitter(0, 0.01);
+
+    SimulationData sd(&sp);
+    place_agents(sd.state, n, sp.r_upper, crowded, gen);
+    sd.reset();
+
+    size_t total_sensed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < steps; t++) {
+        // jitter in agent id order, so every setting sees the same positions whatever the store order
+        for (int i = 0; i < n; i++) {
+            int k = sd.agent_store_slot[i];
+            sd.state.x[k] = std::max(-sp.r_upper, std::min(sp.r_upper, sd.state.x[k] + jitter(gen)));
+            sd.state.y[k] = std::max(-sp.r_upper, std::min(sp.r_upper, sd.state.y[k] + jitter(gen)));
+        }
+        sd.update();
+        for (int i = 0; i < n; i++) { total_sensed += sd.sense(i, sd.state.get_pos(i)).size(); }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if (total_sensed == 0) { printf("Warning: no neighbors sensed.\n"); }
+    return std::chrono::duration<double>(end - start).count() / steps;
+}
+
+
+int main(int argc, char* argv[])
+{
+    // sorted agents scan a whole strip of the arena per query, and the half-size grid piles most agents into its
+    // overflow cell, so both are skipped once they get slow
+    std::vector<search_setting> settings = {
+        {"sorted", true, false, false, false, 0, false, 10000},
+        {"cells", false, true, false, false, 0, false, 0},
+        {"cells/sfc", false, true, false, false, 0, true, 0},
+        {"fixed", false, true, false, false, 1, false, 0},
+        {"fixed/2", false, true, false, false, 0.5, false, 50000}, // a grid that only covers the middle of the arena
+        {"kd_tree", false, false, true, false, 0, false, 0},
+        {"kd/sfc", false, false, true, false, 0, true, 0},
+        {"verlet", false, true, false, true, 0, false, 0},
+        {"verlet/sfc", false, true, false, true, 0, true, 0},
+    };
+    // the jams of the crowded layout do not grow with the arena, so it stops at fewer agents
+    std::vector<int> uniform_counts{1000, 10000, 100000, 1000000};
+    std::vector<int> crowded_counts{1000, 10000, 50000};
+
+    printf("%-8s %-8s", "layout", "agents");
+    for (const search_setting &setting : settings) { printf(" %10s", setting.name); }
+    printf("   (ms per step)\n");
+
+    for (bool crowded : {false, true}) {
+        for (int n : crowded ? crowded_counts : uniform_counts) {
+            int steps = std::max(3, std::min(20, 2000000 / n)); // fewer steps for the largest worlds
+            printf("%-8s %-8d", crowded ? "crowded" : "uniform", n);
+            for (const search_setting &setting : settings) {
+                if (setting.max_agents > 0 && n > setting.max_agents) { printf(" %10s", "-"); continue; }
+                printf(" %10.2f", 1000 * time_setting(setting, n, crowded, steps));
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
@@ -87,6 +87,7 @@ int main(int argc, char* argv[])
 
                     // sim.run_trial(sp.time_steps, i); // replace run_trial or run_trials with a code block that helps save extra data on runtime, etc
                     {
+                        sim.trial = i; // new random streams for each trial
                         sim.reset();
 
                         while (sim.timestep < sp.time_steps) {
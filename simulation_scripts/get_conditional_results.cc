@@ -38,7 +38,7 @@ int main(int argc, char* argv[])
     trials_file_head.close();
 
     std::ofstream agents_file_head(sp.outfile_name, std::ios::out);
-    agents_file_head << "trial,periodic,num_robots,noise,noise_prob,sim_time,robot_id,x_pos,y_pos,angle,goal_x_pos,goal_y_pos,goal_birth_time,goals_reached,stopped,nearby_robot,addtl_data\n";
+    agents_file_head << "trial,periodic,num_robots,noise,noise_prob,sim_time,robot_id,x_pos,y_pos,angle,goal_x_pos,goal_y_pos,goal_birth_time,goals_reached,stopped,nearby_robot,addtl_data,seed\n";
     agents_file_head.close();
 
     std::ofstream trials_file;
@@ -64,6 +64,7 @@ int main(int argc, char* argv[])
     sp.cell_width = 2.0 * sp.cells_range / sp.cells_per_side;
     sp.use_sorted_agents = false;
     sp.use_cell_lists = true;
+    sp.use_cone_stencil = true; // only search cells that can overlap each robot's vision cone
     
 
     sp.avg_runsteps = 50;
@@ -89,6 +90,7 @@ int main(int argc, char* argv[])
     // int total_worlds = periodic_arr.size() * num_agents_arr.size() * (gaussian_noise_arr.size() + noise_prob_arr.size() + 1);
     int total_worlds = periodic_arr.size() * num_agents_arr.size() * (gaussian_noise_arr.size() + 1);
     int complete = 0;
+    SimulationManager *sim = nullptr; // reconfigured for each world, so the agents and cells are only allocated once
     auto all_start_time = std::chrono::high_resolution_clock::now();
 
     printf("Running constant Gaussian noise worlds...");
@@ -104,21 +106,24 @@ int main(int argc, char* argv[])
 
                 auto this_start_time = std::chrono::high_resolution_clock::now();
 
-                SimulationManager sim = SimulationManager(sp);
+                if (sim) { sim->reconfigure(sp); }
+                else { sim = new SimulationManager(sp); }
 
                 // in-planner outfile for saving data about agent positions
-                sim.outfile << std::fixed << std::setprecision(2);
-                sim.outfile.open(sp.outfile_name, std::ios_base::app);
+                sim->outfile << std::fixed << std::setprecision(2);
+                sim->outfile.open(sp.outfile_name, std::ios_base::app);
 
                 for (int i = 0; i < num_trials; i++) {
                     
                     auto trial_start_time = std::chrono::high_resolution_clock::now();
                     {
-                        sim.reset();
-                        while (sim.sd->sim_time < sim_run_length) {
+                        sim->sd->trial = i; // keys the agents' random streams
+                        sim->reset();
+                        sim->sd->end_step = steps_to_reach(sim_run_length, sp.dt); // sensed lists are recorded for the final save
+                        while (sim->sd->step < sim->sd->end_step) {
                     
-                            if (!sp.outfile_name.empty() && fmod(sim.sd->sim_time, sp.save_data_interval) < 0.001) {
-                                sim.save_data(i);
+                            if (sim->save_due()) {
+                                sim->save_data(i);
 
                                 // save timing data
                                 auto cur_time = std::chrono::high_resolution_clock::now();
@@ -126,17 +131,17 @@ int main(int argc, char* argv[])
                                 << sp.anglenoise << std::string(",")
                                 << p << std::string(",") // periodic or not
                                 << i << std::string(",") // trial id
-                                << sim.sd->sim_time << std::string(",")
+                                << sim->sd->sim_time << std::string(",")
                                 << sp.addtl_data << std::string(",")
-                                << sp.num_agents * sim.sd->sim_time / sp.dt << std::string(",")
+                                << sp.num_agents * sim->sd->step << std::string(",")
                                 << std::chrono::duration_cast<std::chrono::milliseconds>(cur_time - trial_start_time).count() << std::endl;
                         
                             }
 
-                            sim.update();
+                            sim->update();
                         }
                     
-                        if (!sp.outfile_name.empty()) { sim.save_data(i); }
+                        if (!sp.outfile_name.empty()) { sim->save_data(i); }
                     }
 
 
@@ -147,12 +152,12 @@ int main(int argc, char* argv[])
                     << sp.anglenoise << std::string(",")
                     << p << std::string(",") // periodic or not
                     << i << std::string(",") // trial id
-                    << sim.sd->sim_time << std::string(",")
+                    << sim->sd->sim_time << std::string(",")
                     << sp.addtl_data << std::string(",")
-                    << sp.num_agents * sim.sd->sim_time / sp.dt << std::string(",")
+                    << sp.num_agents * sim->sd->step << std::string(",")
                     << std::chrono::duration_cast<std::chrono::milliseconds>(trial_end_time - trial_start_time).count() << std::endl;
                 }
-                sim.outfile.close();
+                sim->outfile.close();
 
                 auto this_end_time = std::chrono::high_resolution_clock::now();
                 auto this_duration = std::chrono::duration_cast<std::chrono::milliseconds>(this_end_time - this_start_time);
@@ -177,21 +182,24 @@ int main(int argc, char* argv[])
 
             auto this_start_time = std::chrono::high_resolution_clock::now();
 
-            SimulationManager sim = SimulationManager(sp);
+            if (sim) { sim->reconfigure(sp); }
+            else { sim = new SimulationManager(sp); }
 
-            sim.outfile << std::fixed << std::setprecision(2);
-            sim.outfile.open(sp.outfile_name, std::ios_base::app);
+            sim->outfile << std::fixed << std::setprecision(2);
+            sim->outfile.open(sp.outfile_name, std::ios_base::app);
 
             for (int i = 0; i < num_trials; i++) {
                 
                 auto trial_start_time = std::chrono::high_resolution_clock::now();
-                // sim.run_trial(sim_run_length, i);
+                // sim->run_trial(sim_run_length, i);
                 {
-                    sim.reset();
-                    while (sim.sd->sim_time < sim_run_length) {
+                    sim->sd->trial = i; // keys the agents' random streams
+                    sim->reset();
+                    sim->sd->end_step = steps_to_reach(sim_run_length, sp.dt); // sensed lists are recorded for the final save
+                    while (sim->sd->step < sim->sd->end_step) {
                 
-                        if (!sp.outfile_name.empty() && fmod(sim.sd->sim_time, sp.save_data_interval) < 0.001) {
-                            sim.save_data(i);
+                        if (sim->save_due()) {
+                            sim->save_data(i);
 
                             // save timing data
                             auto cur_time = std::chrono::high_resolution_clock::now();
@@ -199,17 +207,17 @@ int main(int argc, char* argv[])
                             << sp.anglenoise << std::string(",")
                             << p << std::string(",") // periodic or not
                             << i << std::string(",") // trial id
-                            << sim.sd->sim_time << std::string(",")
+                            << sim->sd->sim_time << std::string(",")
                             << sp.addtl_data << std::string(",")
-                            << sp.num_agents * sim.sd->sim_time / sp.dt << std::string(",")
+                            << sp.num_agents * sim->sd->step << std::string(",")
                             << std::chrono::duration_cast<std::chrono::milliseconds>(cur_time - trial_start_time).count() << std::endl;
                     
                         }
 
-                        sim.update();
+                        sim->update();
                     }
                 
-                    if (!sp.outfile_name.empty()) { sim.save_data(i); }
+                    if (!sp.outfile_name.empty()) { sim->save_data(i); }
                 }
 
                 auto trial_end_time = std::chrono::high_resolution_clock::now();
@@ -219,12 +227,12 @@ int main(int argc, char* argv[])
                 << sp.anglenoise << std::string(",")
                 << p << std::string(",") // periodic or not
                 << i << std::string(",") // trial id
-                << sim.sd->sim_time << std::string(",")
+                << sim->sd->sim_time << std::string(",")
                 << sp.addtl_data << std::string(",")
-                << sp.num_agents * sim.sd->sim_time / sp.dt << std::string(",")
+                << sp.num_agents * sim->sd->step << std::string(",")
                 << std::chrono::duration_cast<std::chrono::milliseconds>(trial_end_time - trial_start_time).count() << std::endl;
             }
-            sim.outfile.close();
+            sim->outfile.close();
 
             auto this_end_time = std::chrono::high_resolution_clock::now();
             auto this_duration = std::chrono::duration_cast<std::chrono::milliseconds>(this_end_time - this_start_time);
@@ -235,6 +243,7 @@ int main(int argc, char* argv[])
         }
     }
 
+    delete sim;
     auto all_end_time = std::chrono::high_resolution_clock::now();
     auto all_duration = std::chrono::duration_cast<std::chrono::milliseconds>(all_end_time - all_start_time);
     std::cout << "\nTime taken to run all trials: " << all_duration.count() << " milliseconds" << std::endl;
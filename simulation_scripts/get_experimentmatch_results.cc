@@ -3,6 +3,7 @@
 
 #include <chrono>
 #include "simulation_manager.hh"
+#include "ensemble.hh"
 #include "canvas.hh"
 #include <map>
 #include <utility> 
@@ -26,7 +27,7 @@ int main(int argc, char* argv[])
     sp.outfile_name = (base_dir / "fig3_simulation_data.txt").string();
 
     std::ofstream agents_file_head(sp.outfile_name, std::ios::out);
-    agents_file_head << "trial,periodic,num_robots,noise,noise_prob,sim_time,robot_id,x_pos,y_pos,angle,goal_x_pos,goal_y_pos,goal_birth_time,goals_reached,stopped,nearby_robot,addtl_data\n";
+    agents_file_head << "trial,periodic,num_robots,noise,noise_prob,sim_time,robot_id,x_pos,y_pos,angle,goal_x_pos,goal_y_pos,goal_birth_time,goals_reached,stopped,nearby_robot,addtl_data,seed\n";
     agents_file_head.close();
 
     sp.save_data_interval = 75;
@@ -34,6 +35,7 @@ int main(int argc, char* argv[])
     sp.dt = .1;
     sp.anglebias = 0;
     int num_trials = 100;
+    bool use_ensemble = true; // step every world and trial side by side (same data, saved in a different row order)
 
     // Each row represents a noise, num robots, avg fwd speed, avg turn speed combo from analyzing experimental data 
     std::map<std::pair<double, int>, std::pair<double, double>> speeds_lookup = {
@@ -85,7 +87,7 @@ int main(int argc, char* argv[])
     // sp.sensing_range = 0.2;
     sp.sensing_range = 0.1564;
 
-    sp.cells_range = 1; // only used if not periodic
+    sp.cells_range = 1; // only used if not periodic and hashed_cell_lists is off
     if(sp.periodic) { sp.cells_range = sp.r_upper; }
     sp.cells_per_side = floor(2.0 * sp.cells_range / sp.sensing_range);
     sp.cell_width = 2.0 * sp.cells_range / sp.cells_per_side;
@@ -107,9 +109,11 @@ int main(int argc, char* argv[])
 
     int total_worlds = speeds_lookup.size();
     int complete = 0;
+    SimulationManager *sim = nullptr; // reconfigured for each world, so the agents and cells are only allocated once
     auto all_start_time = std::chrono::high_resolution_clock::now();
     for (bool p : periodic_arr) {
         sp.periodic = p;
+        std::vector<sim_params> worlds;
 
         for (const auto& entry : speeds_lookup) {
             sp.anglenoise      = entry.first.first;
@@ -117,10 +121,16 @@ int main(int argc, char* argv[])
             sp.cruisespeed  = entry.second.first;
             sp.turnspeed = entry.second.second;
 
+            if (use_ensemble) {
+                worlds.push_back(sp);
+                continue;
+            }
+
             auto this_start_time = std::chrono::high_resolution_clock::now();
 
-            SimulationManager sim = SimulationManager(sp);
-            sim.run_trials(num_trials, sim_run_length);
+            if (sim) { sim->reconfigure(sp); }
+            else { sim = new SimulationManager(sp); }
+            sim->run_trials(num_trials, sim_run_length);
 
 
             auto this_end_time = std::chrono::high_resolution_clock::now();
@@ -129,7 +139,14 @@ int main(int argc, char* argv[])
             complete += 1;
             printf("Just ran World %i / %i in %lli seconds: periodic %i, robots %i, noise %f \n", complete, total_worlds, this_duration.count(), sp.periodic, sp.num_agents, sp.anglenoise);    
         }
+
+        if (use_ensemble) {
+            Ensemble ensemble = Ensemble(worlds, num_trials);
+            ensemble.run(sim_run_length);
+            printf("Just ran %i worlds as one ensemble: periodic %i \n", total_worlds, sp.periodic);
+        }
     }
+    delete sim;
     auto all_end_time = std::chrono::high_resolution_clock::now();
     auto all_duration = std::chrono::duration_cast<std::chrono::seconds>(all_end_time - all_start_time);
     std::cout << "\nTime taken to run all trials: " << all_duration.count() << " seconds" << std::endl;
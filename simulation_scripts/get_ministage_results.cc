@@ -36,7 +36,7 @@ int main(int argc, char* argv[])
     std::filesystem::create_directories(base_dir);
     sp.outfile_name = (base_dir / "fig2_simulation_data.txt").string();
     std::ofstream agents_file_head(sp.outfile_name, std::ios::out);
-    agents_file_head << "trial,periodic,num_robots,noise,noise_prob,sim_time,robot_id,x_pos,y_pos,angle,goal_x_pos,goal_y_pos,goal_birth_time,goals_reached,stopped,nearby_robot,addtl_data\n";
+    agents_file_head << "trial,periodic,num_robots,noise,noise_prob,sim_time,robot_id,x_pos,y_pos,angle,goal_x_pos,goal_y_pos,goal_birth_time,goals_reached,stopped,nearby_robot,addtl_data,seed\n";
     agents_file_head.close();
 
 
@@ -47,6 +47,15 @@ int main(int argc, char* argv[])
     int num_trials_high_variance = 50;
     int num_trials_low_variance = 20; // run fewer trials for regions where the variance low (as we saw from previous runs)
 
+    // Warm starts: burn each world in num_snapshots times from random poses, save the equilibrated states, and start
+    // its trials from them, so trials only simulate the measurement window (sim_run_length - burn_in seconds)
+    // Warm trials' clocks start at the burn-in, so their rows have the same times as those of cold trials
+    // Snapshots are kept in fig2_snapshots and reused by later runs
+    bool warm_start = false;
+    double burn_in = 2000;
+    int num_snapshots = 10;
+    if (warm_start) { sp.snapshot_dir = (base_dir / "fig2_snapshots").string(); }
+
     // parameters to leave unchanged
     sp.r_upper = 20;
     sp.r_lower = 0;
@@ -57,9 +66,10 @@ int main(int argc, char* argv[])
     sp.sensing_angle = M_PI * 2.0 / 3.0;
     sp.sensing_range = 2;
 
-    sp.cells_range = 50; // only used if not periodic
+    sp.cells_range = 50; // only used if not periodic and hashed_cell_lists is off
     sp.use_sorted_agents = false;
     sp.use_cell_lists = true;
+    sp.use_cone_stencil = true; // only search cells that can overlap each robot's vision cone
     
 
     sp.avg_runsteps = 10;
@@ -68,6 +78,8 @@ int main(int argc, char* argv[])
     sp.cruisespeed = 0.5;
     sp.dt = .1;
 
+    sp.num_threads = 1; // set > 1 to split the sense and move phases of each step across worker threads
+
     sp.goal_tolerance = 0.6; // sp.avg_runsteps * sp.dt * sp.cruisespeed;
 
     sp.gui_speedup = 25; // speed up gui compared to real time
@@ -82,6 +94,8 @@ int main(int argc, char* argv[])
 
     int total_worlds = periodic_arr.size() * num_agents_arr.size() * noise_arr.size();
     int complete = 0;
+    SimulationManager *sim = nullptr; // reconfigured for each world, so the agents and cells are only allocated once
+    double total_burn_in_saved = 0, total_burn_in_run = 0;
     auto all_start_time = std::chrono::high_resolution_clock::now();
     for (bool p : periodic_arr) {
         for (int num : num_agents_arr) {
@@ -97,11 +111,22 @@ int main(int argc, char* argv[])
 
                 auto this_start_time = std::chrono::high_resolution_clock::now();
 
-                SimulationManager sim = SimulationManager(sp);
+                if (sim) { sim->reconfigure(sp); }
+                else { sim = new SimulationManager(sp); }
 
 
                 int num_trials = (sp.num_agents <= 128 && sp.anglenoise <= 2.0) ? num_trials_high_variance : num_trials_low_variance;
-                sim.run_trials(num_trials, sim_run_length);
+                double trial_length = sim_run_length;
+                if (warm_start) {
+                    int missing = num_snapshots - (int)sim->snapshots.size();
+                    if (missing > 0) {
+                        sim->save_snapshots(missing, burn_in);
+                        total_burn_in_run += missing * burn_in;
+                    }
+                    trial_length = sim_run_length - burn_in;
+                }
+                sim->run_trials(num_trials, trial_length);
+                total_burn_in_saved += sim->burn_in_saved;
 
 
                 auto this_end_time = std::chrono::high_resolution_clock::now();
@@ -109,13 +134,19 @@ int main(int argc, char* argv[])
 
                 complete += 1;
                 printf("Just ran World %i / %i in %lli milliseconds: periodic %i, robots %i, noise %f \n", complete, total_worlds, this_duration.count(), p, num, noise);
+                if (warm_start) { printf("    started from snapshots, skipping %.0f s of burn-in \n", sim->burn_in_saved); }
                 
 
             }
         }
     }
+    delete sim;
     auto all_end_time = std::chrono::high_resolution_clock::now();
     auto all_duration = std::chrono::duration_cast<std::chrono::seconds>(all_end_time - all_start_time);
     std::cout << "\nTime taken to run all trials: " << all_duration.count() << " seconds" << std::endl;
+    if (warm_start) {
+        printf("Warm starts skipped %.0f s of simulated burn-in, for %.0f s spent burning in new snapshots (%.0f s saved)\n",
+               total_burn_in_saved, total_burn_in_run, total_burn_in_saved - total_burn_in_run);
+    }
 
 }
\ No newline at end of file
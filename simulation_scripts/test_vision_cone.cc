@@ -0,0 +1,28 @@
+// Checks that the batched vision cone kernels (vision_cone_batch, double and single precision) make exactly the same
+// decisions as in_vision_cone, on random and edge-of-cone cases in periodic and bounded arenas
+// Exits with a non-zero status if any decision differs
+// usage: test_vision_cone [num_tests] [seed]
+// (seed defaults to a fresh one, printed so a failure can be replayed)
+
+#include "simulation_manager.hh"
+
+
+int main(int argc, char* argv[])
+{
+    int num_tests = argc > 1 ? atoi(argv[1]) : 100000;
+    unsigned int seed = argc > 2 ? strtoul(argv[2], nullptr, 10) : std::random_device{}();
+    Random::mt.seed(seed);
+    printf("Seed: %u \n", seed);
+
+    bool agree = true;
+    for (int periodic = 0; periodic <= 1; periodic++) {
+        for (int single_precision = 0; single_precision <= 1; single_precision++) {
+            bool ok = vision_cone_batch_agrees(num_tests, periodic, single_precision);
+            printf("%s precision, %s arena: %s \n", single_precision ? "single" : "double", periodic ? "periodic" : "bounded",
+                   ok ? "agrees with in_vision_cone" : "DISAGREES with in_vision_cone");
+            agree = agree && ok;
+        }
+    }
+
+    return agree ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+// Checks a single precision build (cmake -DMINISTAGE_FLOAT32=ON) against the default double precision build
+// Runs the Fig. 2 parameter grid of get_ministage_results.cc and saves each world's goal rate (goals reached per agent
+// per second, mean and standard error over trials) to goal_rates_float32.txt or goal_rates_float64.txt, depending on
+// the build. Worlds run through SimulationManager with the cell list settings of get_ministage_results.cc, so the
+// rates come from the same sensing path as the Fig. 2 data. Once both files exist, whichever build runs second
+// compares them world by world.
+// Trajectories diverge between the builds, so only the statistics are expected to agree.
+// usage: validate_precision [trial_length (s)] [trials] [grid_stride]
+// (defaults to a shortened run over every 4th agent count and noise level; validate_precision 8000 20 1 covers all of it)
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include "simulation_manager.hh"
+
+const char* redText = "\033[1;31m";
+const char* resetText = "\033[0m";
+
+// worlds whose goal rates differ by more than this many standard errors count as disagreeing
+static const double MAX_Z_SCORE = 3.0;
+
+struct goal_rate {
+    int trials;
+    double mean, std_err;
+};
+
+typedef std::map<std::pair<int, int>, goal_rate> goal_rate_table; // keyed by (num_robots, noise in tenths)
+
+
+static void save_goal_rates(const std::string &file_name, const goal_rate_table &rates) {
+    std::ofstream file(file_name, std::ios::out);
+    file << "num_robots,noise,trials,goal_rate,std_err\n";
+    file << std::setprecision(9);
+    for (const auto &entry : rates) {
+        file << entry.first.first << "," << entry.first.second / 10.0 << "," << entry.second.trials << ","
+             << entry.second.mean << "," << entry.second.std_err << "\n";
+    }
+}
+
+static bool load_goal_rates(const std::string &file_name, goal_rate_table &rates) {
+    std::ifstream file(file_name);
+    if (!file) { return false; }
+
+    std::string line;
+    std::getline(file, line); // header
+    while (std::getline(file, line)) {
+        int num;
+        double noise;
+        goal_rate r;
+        if (sscanf(line.c_str(), "%d,%lf,%d,%lf,%lf", &num, &noise, &r.trials, &r.mean, &r.std_err) == 5) {
+            rates[{num, (int)lround(10 * noise)}] = r;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    double sim_run_length = argc > 1 ? atof(argv[1]) : 2000;
+    int num_trials = argc > 2 ? atoi(argv[2]) : 10;
+    int grid_stride = argc > 3 ? std::max(1, atoi(argv[3])) : 4;
+
+#ifdef MINISTAGE_FLOAT32
+    const char *precision = "float32", *other_precision = "float64";
+#else
+    const char *precision = "float64", *other_precision = "float32";
+#endif
+
+    // Fig. 2 grid and parameters, as in get_ministage_results.cc
+    std::vector<int> num_agents_arr = { 16,  20,  24,  28,  32,  36,  40,  44,  48,  52,  56,  60,  64,
+                                        68,  72,  76,  80,  84,  88,  92,  96, 100, 104, 108, 112, 116,
+                                        120, 124, 128, 132, 136, 140, 144, 148, 152, 156, 160, 164, 168,
+                                        172, 176, 180, 184, 188, 192, 196, 200, 204, 208, 212, 216, 220,
+                                        224, 228, 232, 236, 240, 244, 248, 252, 256};
+
+    std::vector<float> noise_arr = {0., 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1. , 1.1, 1.2,
+       1.3, 1.4, 1.5, 1.6, 1.7, 1.8, 1.9, 2., 2.1, 2.2, 2.3, 2.4, 2.5, 2.6, 2.7, 2.8, 2.9, 3.0};
+
+    sim_params sp;
+    sp.periodic = true;
+    sp.anglebias = 0;
+    sp.turnspeed = -1; // -1 for instant turning
+    sp.circle_arena = false;
+    sp.r_upper = 20;
+    sp.r_lower = 0;
+    sp.noise_prob = 1.0;
+    sp.conditional_noise = false;
+    sp.sensing_angle = M_PI * 2.0 / 3.0;
+    sp.sensing_range = 2;
+    sp.avg_runsteps = 10;
+    sp.randomize_runsteps = true;
+    sp.cruisespeed = 0.5;
+    sp.dt = .1;
+    sp.goal_tolerance = 0.6;
+    sp.seed = 12345; // same streams in both builds
+    sp.verbose = false;
+    sp.save_data_interval = 0; // only the goal counts are needed
+    sp.gui_draw_footprints = false;
+    sp.gui_random_colors = false;
+
+    // neighbor search, as in get_ministage_results.cc
+    sp.cells_range = sp.r_upper;
+    sp.cells_per_side = floor(2.0 * sp.cells_range / sp.sensing_range);
+    sp.cell_width = 2.0 * sp.cells_range / sp.cells_per_side;
+    sp.use_sorted_agents = false;
+    sp.use_cell_lists = true;
+    sp.use_cone_stencil = true;
+
+    printf("Running the Fig. 2 grid in %s: %.0f s trials, %i trials per world, every %i agent counts and noise levels\n",
+           precision, sim_run_length, num_trials, grid_stride);
+
+    goal_rate_table rates;
+    SimulationManager *sim = nullptr; // reconfigured for each world, so the agents and cells are only allocated once
+    auto all_start_time = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < num_agents_arr.size(); i += grid_stride) {
+        for (size_t j = 0; j < noise_arr.size(); j += grid_stride) {
+            sp.num_agents = num_agents_arr[i];
+            sp.anglenoise = noise_arr[j];
+
+            if (sim) { sim->reconfigure(sp); }
+            else { sim = new SimulationManager(sp); }
+
+            // goals reached per agent per second in each trial, averaged over the trials
+            double sum = 0, sum_sq = 0;
+            for (int t = 0; t < num_trials; t++) {
+                sim->run_trial(sim_run_length, t);
+                int goals = 0;
+                for (int k = 0; k < sp.num_agents; k++) { goals += sim->sd->state.goals_reached[k]; }
+                double rate = goals / (sp.num_agents * sim_run_length);
+                sum += rate;
+                sum_sq += rate * rate;
+            }
+
+            goal_rate r;
+            r.trials = num_trials;
+            r.mean = sum / num_trials;
+            double var = num_trials > 1 ? std::max(0.0, (sum_sq - num_trials * r.mean * r.mean) / (num_trials - 1)) : 0;
+            r.std_err = sqrt(var / num_trials);
+            rates[{sp.num_agents, (int)lround(10 * sp.anglenoise)}] = r;
+        }
+
+        printf("Ran %i robots\n", num_agents_arr[i]);
+    }
+    delete sim;
+    auto all_end_time = std::chrono::high_resolution_clock::now();
+    auto all_duration = std::chrono::duration_cast<std::chrono::seconds>(all_end_time - all_start_time);
+    std::cout << "\nTime taken to run all trials: " << all_duration.count() << " seconds" << std::endl;
+
+    std::filesystem::path base_dir = SIM_DATA_DIR;
+    std::filesystem::create_directories(base_dir);
+    std::string file_name = (base_dir / (std::string("goal_rates_") + precision + ".txt")).string();
+    std::string other_file_name = (base_dir / (std::string("goal_rates_") + other_precision + ".txt")).string();
+    save_goal_rates(file_name, rates);
+    printf("Saved goal rates to %s\n", file_name.c_str());
+
+    // compare against the other build's goal rates, over the worlds both have run
+    goal_rate_table other_rates;
+    if (!load_goal_rates(other_file_name, other_rates)) {
+        printf("No %s goal rates to compare against yet: run validate_precision from a %s build too.\n", other_precision, other_precision);
+        return 0;
+    }
+
+    int compared = 0, disagree = 0;
+    double max_z = 0, sum_rel_diff = 0;
+    for (const auto &entry : rates) {
+        auto other = other_rates.find(entry.first);
+        if (other == other_rates.end()) { continue; }
+
+        const goal_rate &a = entry.second, &b = other->second;
+        double diff = a.mean - b.mean;
+        double err = sqrt(a.std_err * a.std_err + b.std_err * b.std_err);
+        double z = err > 0 ? fabs(diff) / err : (diff == 0 ? 0 : std::numeric_limits<double>::infinity());
+        compared++;
+        max_z = std::max(max_z, z);
+        if (b.mean > 0) { sum_rel_diff += fabs(diff) / b.mean; }
+
+        if (z > MAX_Z_SCORE) {
+            disagree++;
+            printf("%s%i robots, noise %.1f: goal rate %.6g (%s) vs %.6g (%s), %.1f standard errors apart%s\n", redText,
+                   entry.first.first, entry.first.second / 10.0, a.mean, precision, b.mean, other_precision, z, resetText);
+        }
+    }
+
+    if (compared == 0) {
+        printf("No worlds in common with %s: rerun both builds with the same arguments.\n", other_file_name.c_str());
+        return 0;
+    }
+
+    // by chance alone, about 0.3% of worlds land more than 3 standard errors apart
+    printf("\nCompared %i worlds against %s: %i differ by more than %.0f standard errors (largest %.2f), mean relative difference %.2f%%\n",
+           compared, other_precision, disagree, MAX_Z_SCORE, max_z, 100 * sum_rel_diff / compared);
+    bool pass = disagree <= std::max(1, (int)ceil(0.01 * compared));
+    printf("%s\n", pass ? "Goal rates agree between precisions." : "Goal rates DISAGREE between precisions.");
+    return pass ? 0 : 1;
+}
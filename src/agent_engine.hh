@@ -0,0 +1,556 @@
+#ifndef AGENT_ENGINE_H
+#define AGENT_ENGINE_H
+
+#include <cmath>
+#include "../random.hh"
+#include "utils.hh"
+#include "../shared_utils.hh"
+
+// Template agent engine
+// The per-agent update is written once, with the goal model and the noise model as compile-time policies,
+// so a whole step of an agent is inlined into one loop with no virtual calls. Agent state lives in the
+// SimulationData agent store; the Agent classes in agents.hh are thin wrappers over these functions for the GUI.
+
+
+// Modes: the per-step flags that a run never changes, either read from sim_params each time (RuntimeMode) or fixed at
+// compile time (FixedMode), so the step loop can be instantiated without these branches (see make_agent_engine)
+struct RuntimeMode {
+    static bool periodic(const sim_params &sp) { return sp.periodic; }
+    static bool instant_turn(const sim_params &sp) { return sp.turnspeed == -1; }
+    static bool conditional_noise(const sim_params &sp) { return sp.conditional_noise; }
+    static bool randomize_runsteps(const sim_params &sp) { return sp.randomize_runsteps; }
+};
+
+template <bool Periodic, bool InstantTurn, bool ConditionalNoise, bool RandomizeRunsteps>
+struct FixedMode {
+    static bool periodic(const sim_params &) { return Periodic; }
+    static bool instant_turn(const sim_params &) { return InstantTurn; }
+    static bool conditional_noise(const sim_params &) { return ConditionalNoise; }
+    static bool randomize_runsteps(const sim_params &) { return RandomizeRunsteps; }
+};
+
+
+// One agent's view of the simulation, passed to the policies
+// The agent's state is at index id of the store, and agent is its own id: the id of the agent in that slot of a
+// SimulationData (see SimulationData::renumber_agents), or in an Ensemble, whose store holds many worlds, the agent's
+// id within its own world
+struct AgentRef {
+    const sim_params &sp;
+    SimulationData *sd; // for sensing; nullptr in an Ensemble, which senses by itself
+    AgentStore &s;
+    int id;
+    int agent;
+    int trial;
+    uint64_t step;
+    double sim_time;
+
+    AgentRef(SimulationData &sim_data, int store_id) 
+        : sp(*sim_data.sp), sd(&sim_data), s(sim_data.state), id(store_id), agent(sim_data.slot_agent[store_id]), 
+        trial(sim_data.trial), step(sim_data.step), sim_time(sim_data.sim_time) {}
+
+    AgentRef(const sim_params &sim_params, AgentStore &store, int store_id, int agent_id, int trial_id, uint64_t cur_step, double cur_time) 
+        : sp(sim_params), sd(nullptr), s(store), id(store_id), agent(agent_id), trial(trial_id), step(cur_step), sim_time(cur_time) {}
+
+    // A fresh random stream for this agent, keyed by (sp.seed, trial, agent, step)
+    Random::Stream new_stream() const { return Random::Stream(sp.seed, trial, agent, step); }
+
+    // This agent's random stream for the current step
+    // Rekeyed on the first draw of each step (or trial)
+    Random::Stream &rng() const {
+        Random::Stream &stream = s.rng[id];
+        if (stream.step() != step || stream.trial() != (uint32_t)trial) {
+            stream = new_stream();
+        }
+        return stream;
+    }
+};
+
+
+// Steps shared by every kind of agent
+struct AgentSteps {
+    // Use rejection sampling to obtain a random point in a the ring between radius r_lower and r_upper (center at origin)
+    // Or, if not in a circular arena, in the square with center at origin and side length 2 * r_upper
+    static Pose2 random_pos(const AgentRef &a) {
+        bool done = 0;
+        double rand_x;
+        double rand_y;
+        double rand_a = 2 * M_PI * (a.rng().get_unif_double(0, 1) - .5);
+
+        while (!done) {
+            rand_x = a.sp.r_upper * 2 * (a.rng().get_unif_double(0, 1) - .5);
+            rand_y = a.sp.r_upper * 2 * (a.rng().get_unif_double(0, 1) - .5);
+            double dist = Pose2(rand_x, rand_y, 0).Distance(Pose2(0, 0, 0));
+            if (!a.sp.circle_arena || (dist <= a.sp.r_upper && dist >= a.sp.r_lower)) { done = 1; }
+        }
+
+        if (a.sp.verbose) {
+        printf("Random Pose (x, y, angle) generated for agent %i is [%.2f %.2f %.2f] \n", a.agent, rand_x, rand_y, rand_a);
+        }
+
+        return Pose2(rand_x, rand_y, rand_a);
+    }
+
+    // 32-bit draws random_pos usually takes: the angle, and two coordinates for each of the expected tries
+    static int random_pos_draws(const sim_params &sp) {
+        if (!sp.circle_arena) { return 6; }
+        double ring = M_PI * (sp.r_upper * sp.r_upper - sp.r_lower * sp.r_lower);
+        return 2 + 4 * (int)std::ceil(4 * sp.r_upper * sp.r_upper / ring);
+    }
+
+    // Stop and move to a random pose, starting the reset's draws from the top of the agent's stream
+    // (unless the caller has just restarted it, as AgentEngine::reset_batch does)
+    static void reset(const AgentRef &a, bool restart_stream = true) {
+        if (restart_stream) { a.s.rng[a.id] = a.new_stream(); }
+        a.s.fwd_speed[a.id] = 0;
+        a.s.turn_speed[a.id] = 0;
+        a.s.set_pos(a.id, random_pos(a));
+        a.s.sensed[a.id].clear();
+        a.s.sensed_any[a.id] = 0;
+    }
+
+    // Find neighbors in vision cone
+    // Only reads other agents' positions, so it is safe to run for all agents in parallel
+    // Returns false if the agent kept its last result instead (see SimulationData::sense_unchanged)
+    static bool sense(const AgentRef &a) {
+        std::vector<sensor_result> &sensed = a.s.sensed[a.id];
+        Pose2 pos = a.s.get_pos(a.id);
+        if (a.sd->sense_unchanged(a.id, pos)) {
+            sensed.clear();
+            return false;
+        }
+
+        if (a.sp.event_driven_sensing) { a.sd->sensed_from[a.id] = pos; }
+
+        if (a.sd->record_sensed) {
+            sensed = a.sd->sense(a.id, a.s.get_pos(a.id));
+            a.s.sensed_any[a.id] = sensed.size() > 0;
+        }
+        else {
+            // the full list is not needed, so stop at the first neighbor found
+            sensed.clear();
+            a.s.sensed_any[a.id] = a.sd->sense_any(a.id, a.s.get_pos(a.id));
+        }
+        return true;
+    }
+
+    // Whether moving would leave the agent's pose exactly as it is (no speed, heading already normalized)
+    static bool stationary(const AgentRef &a) {
+        double heading = a.s.a[a.id];
+        return a.s.fwd_speed[a.id] == 0 && a.s.turn_speed[a.id] == 0 && heading > -M_PI && heading <= M_PI;
+    }
+
+    // Use forward and turning speed to update robot position
+    template <class Mode = RuntimeMode>
+    static void move(const AgentRef &a) {
+        const sim_params &sp = a.sp;
+
+        // find the change of pose due to our forward and turning motions
+        const Pose2 dp(a.s.fwd_speed[a.id] * sp.dt, 0, normalize(a.s.turn_speed[a.id] * sp.dt));
+
+        // the pose we're trying to achieve
+        Pose2 newpose(a.s.get_pos(a.id) + dp);
+
+        // update location if world is periodic and robot is now out of bounds
+        if (Mode::periodic(sp)) {
+            double s = 2 * sp.r_upper;
+
+            if (newpose.x < -s/2 || newpose.x > s/2 || newpose.y < -s/2 || newpose.y > s/2) { // if out of bounds
+            double x = fmod(newpose.x + s/2, s) - s/2;
+            double y = fmod(newpose.y + s/2, s) - s/2;
+            newpose = Pose2(x > -s/2 ? x : x + s, y > -s/2 ? y : y + s, newpose.a);
+            }
+        }
+
+        a.s.set_pos(a.id, newpose);
+    }
+};
+
+
+// Goal policy: each agent heads for its own randomly generated goal, and gets a new one on arrival
+struct RandomGoals {
+    // 32-bit draws a new goal usually takes
+    static int draws(const sim_params &sp) { return AgentSteps::random_pos_draws(sp); }
+
+    static void reset(const AgentRef &a) {
+        a.s.stop[a.id] = 0;
+        a.s.set_goal(a.id, AgentSteps::random_pos(a)); // set goal
+        a.s.goal_birth_time[a.id] = a.sim_time;
+        a.s.goals_reached[a.id] = 0;
+    }
+
+    static bool reached(const AgentRef &a) {
+        return a.s.get_pos(a.id).Distance(a.s.get_goal(a.id)) < a.sp.goal_tolerance;
+    }
+
+    // increase goal counters and generate a new goal
+    static void new_goal(const AgentRef &a) {
+        a.s.set_goal(a.id, AgentSteps::random_pos(a));
+        a.s.goals_reached[a.id]++;
+        a.s.goal_birth_time[a.id] = a.sim_time;
+    }
+
+    // The goal, or if space is periodic, its copy closest to the agent
+    template <class Mode = RuntimeMode>
+    static Pose2 nearest_goal(const AgentRef &a) {
+        if (!Mode::periodic(a.sp)) { return a.s.get_goal(a.id); }
+        return nearest_periodic(a.s.get_pos(a.id), a.s.get_goal(a.id), a.sp.r_upper);
+    }
+
+    // Get (global) angle robot should move in to head straight to goal
+    template <class Mode = RuntimeMode>
+    static double angle_to_goal(const AgentRef &a) {
+        Pose2 goal_pos_helper = nearest_goal<Mode>(a);
+        double x_error = goal_pos_helper.x - a.s.x[a.id];
+        double y_error = goal_pos_helper.y - a.s.y[a.id];
+
+        return atan2(y_error, x_error);
+    }
+
+    template <class Mode = RuntimeMode>
+    static double dist_to_goal(const AgentRef &a) {
+        Pose2 goal_pos_helper = nearest_goal<Mode>(a);
+        double x_error = goal_pos_helper.x - a.s.x[a.id];
+        double y_error = goal_pos_helper.y - a.s.y[a.id];
+
+        return std::sqrt(x_error * x_error + y_error * y_error);
+    }
+};
+
+
+// Noise policies: how an agent picks its travel angle
+// With run_phases, the angle is only redrawn at the start of each run phase (of about avg_runsteps steps)
+
+// Head straight to the goal (GoalAgent)
+struct NoNoise {
+    static const bool run_phases = false;
+    static int draws(const sim_params &) { return 0; } // 32-bit draws for each travel angle
+
+    template <class Goals, class Mode = RuntimeMode>
+    static double travel_angle(const AgentRef &a) { return Goals::template angle_to_goal<Mode>(a); }
+};
+
+// Add noise to the direction of motion every time a new direction is chosen (ConstNoiseAgent)
+struct ConstNoise {
+    static const bool run_phases = true;
+    static int draws(const sim_params &) { return 2; }
+
+    template <class Goals, class Mode = RuntimeMode>
+    static double travel_angle(const AgentRef &a) {
+        return Goals::template angle_to_goal<Mode>(a) + (a.sp.anglenoise == -1 ? a.rng().get_unif_double(-M_PI, M_PI) :
+                                          a.rng().get_normal_double(a.sp.anglebias, a.sp.anglenoise));
+    }
+};
+
+// Add noise with probability noise_prob, and with conditional_noise only while blocked (NoiseAgent)
+struct ConditionalNoise {
+    static const bool run_phases = true;
+    static int draws(const sim_params &sp) { return sp.noise_prob < 1 ? 4 : 2; }
+
+    template <class Goals, class Mode = RuntimeMode>
+    static double travel_angle(const AgentRef &a) {
+        double without_noise = Goals::template angle_to_goal<Mode>(a);
+        double with_noise = ConstNoise::travel_angle<Goals, Mode>(a);
+
+        if (!Mode::conditional_noise(a.sp) || a.s.stop[a.id]) { // unless conditional noise is on and robot is free to move,
+        // add noise to motion with noise_prob probability (always, without a draw, when it is 1)
+            if (a.sp.noise_prob >= 1 || a.rng().get_unif_double(0, 1) <= a.sp.noise_prob) {
+                return with_noise;
+            }
+        }
+
+        // otherwise head directly to goal
+        return without_noise;
+    }
+};
+
+
+// Steps a range of agents, hiding the policies from SimulationManager (one virtual call per range, not per agent)
+// Ranges are of store slots, in the order the agents sit in the store
+class AgentEngineBase {
+    public:
+    virtual ~AgentEngineBase() {}
+
+    // Reset agents [begin, end) for a new trial
+    virtual void reset(int begin, int end) = 0;
+
+    // Sense, check goals and choose new speeds for agents [begin, end)
+    // Only writes the agents' own state and reads others' positions, so ranges can run in parallel
+    virtual void sensing_update(int begin, int end) = 0;
+
+    // Move agents [begin, end)
+    virtual void position_update(int begin, int end) = 0;
+};
+
+
+template <class Goals, class Noise, class Mode = RuntimeMode>
+class AgentEngine : public AgentEngineBase {
+    public:
+    AgentEngine(SimulationData *sim_data) : sd(sim_data) {}
+
+    // Reset robot data for a new trial
+    static void reset_agent(const AgentRef &a, bool restart_stream = true) {
+        AgentSteps::reset(a, restart_stream);
+        Goals::reset(a);
+        a.s.travel_angle[a.id] = 0;
+        a.s.phase_count[a.id] = 0;
+    }
+
+    // Updates to make when robot reaches goal
+    static void goal_updates(const AgentRef &a) {
+        Goals::new_goal(a);
+        if (Noise::run_phases) { a.s.phase_count[a.id] = 0; }
+    }
+
+    // React to sensor information
+    // sensing does not depend on the goal, so the neighbors can be sensed before the goal check
+    static void process_sensed(const AgentRef &a) {
+        check_goal(a);
+        decision_update(a);
+    }
+
+    // The part of process_sensed before the decision
+    static void check_goal(const AgentRef &a) {
+        // first, check if robot has reached its goal and update variables accordingly
+        if (Goals::reached(a)) { goal_updates(a); }
+
+        a.s.stop[a.id] = a.s.sensed_any[a.id]; // agent will stop if any neighbor was sensed in vision cone
+    }
+
+    // Returns false if sensing was skipped
+    static bool sensing_update(const AgentRef &a) {
+        bool sensed = AgentSteps::sense(a);
+        process_sensed(a);
+        return sensed;
+    }
+
+    // reset_agent for the agents in slots [begin, end) of store s, where ref(k) is the AgentRef of slot k
+    // Their streams are restarted and filled together (Random::Stream::reserve) with the draws of the spawn point and
+    // first goal, which each agent then takes one by one
+    template <class MakeRef>
+    static void reset_batch(AgentStore &s, const sim_params &sp, int begin, int end, const MakeRef &ref) {
+        Random::Stream *streams[RNG_BATCH_SIZE];
+        for (int first = begin; first < end; first += RNG_BATCH_SIZE) {
+            int n = std::min(end - first, RNG_BATCH_SIZE);
+            for (int j = 0; j < n; j++) {
+                s.rng[first + j] = ref(first + j).new_stream();
+                streams[j] = &s.rng[first + j];
+            }
+            Random::Stream::reserve(streams, n, AgentSteps::random_pos_draws(sp) + Goals::draws(sp));
+            for (int j = 0; j < n; j++) { reset_agent(ref(first + j), false); }
+        }
+    }
+
+    // check_goal for the agents in slots [begin, end), where ref(k) is the AgentRef of slot k
+    // Agents that reached their goals have their streams filled together with the draws of the new goal and of the run
+    // phase it starts, then draw them one by one
+    template <class MakeRef>
+    static void goal_batch(const sim_params &sp, int begin, int end, const MakeRef &ref) {
+        int arrivals[RNG_BATCH_SIZE];
+        int num_arrivals = 0;
+        for (int k = begin; k < end; k++) {
+            AgentRef a = ref(k);
+            if (Goals::reached(a)) { arrivals[num_arrivals++] = k; }
+            a.s.stop[a.id] = a.s.sensed_any[a.id]; // agent will stop if any neighbor was sensed in vision cone
+            if (num_arrivals == RNG_BATCH_SIZE || (k == end - 1 && num_arrivals > 0)) {
+                reserve_streams(arrivals, num_arrivals, Goals::draws(sp) + (Noise::run_phases ? phase_start_draws(sp) : 0), ref);
+                for (int j = 0; j < num_arrivals; j++) { goal_updates(ref(arrivals[j])); }
+                num_arrivals = 0;
+            }
+        }
+    }
+
+    // decision_update for the agents in slots [begin, end) of store s, where ref(k) is the AgentRef of slot k
+    // (every agent's goal check must already be done). Agents starting a new run phase have their streams filled
+    // together and draw their run length and travel angle from them one by one, then steer_batch sets every agent's
+    // speeds in SIMD lanes, so each agent sees exactly the steps of decision_update
+    template <class MakeRef>
+    static void decision_batch(AgentStore &s, const sim_params &sp, int begin, int end, const MakeRef &ref) {
+        if (!Noise::run_phases) {
+            for (int k = begin; k < end; k++) { decision_update(ref(k)); }
+            return;
+        }
+
+        int starts[RNG_BATCH_SIZE];
+        int num_starts = 0;
+        for (int k = begin; k < end; k++) {
+            if (s.phase_count[k] >= s.runsteps[k]) { s.phase_count[k] = 0; }
+            if (s.phase_count[k] == 0) { starts[num_starts++] = k; }
+            if (num_starts == RNG_BATCH_SIZE || (k == end - 1 && num_starts > 0)) {
+                reserve_streams(starts, num_starts, phase_start_draws(sp), ref);
+                for (int j = 0; j < num_starts; j++) { start_phase(ref(starts[j])); }
+                num_starts = 0;
+            }
+        }
+
+        steer_params p;
+        p.cruisespeed = sp.cruisespeed;
+        p.turnspeed = sp.turnspeed;
+        p.instant_turn = Mode::instant_turn(sp);
+        steer_batch(p, &s.travel_angle[begin], &s.a[begin], &s.stop[begin], &s.phase_count[begin], &s.fwd_speed[begin],
+                    &s.turn_speed[begin], end - begin);
+    }
+
+    // Set forward and (non-instantaneous) turning speed for steering from heading towards travel_angle
+    // Returns the size of the angle error
+    static double steer(const AgentRef &a, double travel_angle, double heading) {
+        const sim_params &sp = a.sp;
+        double a_error = normalize(travel_angle - heading);
+        double abs_a_error = std::fabs(a_error);
+
+        // robots do not move forward if they are blocked or still turning
+        a.s.fwd_speed[a.id] = (a.s.stop[a.id] || abs_a_error > M_PI / 20) ? 0 : sp.cruisespeed;
+
+        // for non-instantaneous turning, set turnspeed
+        if (!Mode::instant_turn(sp)) {
+            // use full turn speed until we are close to the final angle
+            a.s.turn_speed[a.id] = abs_a_error > M_PI / 10 ? sp.turnspeed * (a_error / abs_a_error) : sp.turnspeed * a_error;
+        }
+
+        return abs_a_error;
+    }
+
+    // for instantaneous turning, set robot to travel angle
+    static void turn_instantly(const AgentRef &a, double travel_angle) {
+        if (Mode::instant_turn(a.sp)) {
+            Pose2 cur_pos = a.s.get_pos(a.id);
+            a.s.set_pos(a.id, Pose2(cur_pos.x, cur_pos.y, travel_angle));
+            a.s.turn_speed[a.id] = 0;
+        }
+    }
+
+    // Update the robot's intended forward and turning speed
+    static void decision_update(const AgentRef &a) {
+        real_t &travel_angle = a.s.travel_angle[a.id];
+
+        // without run phases, head for the travel angle every step (speeds use the heading from before the turn)
+        if (!Noise::run_phases) {
+            travel_angle = Noise::template travel_angle<Goals, Mode>(a);
+            steer(a, travel_angle, a.s.a[a.id]);
+            turn_instantly(a, travel_angle);
+            return;
+        }
+
+        int &current_phase_count = a.s.phase_count[a.id];
+
+        // check if current run phase is over
+        if (current_phase_count >= a.s.runsteps[a.id]) {
+            current_phase_count = 0;
+        }
+
+        if (current_phase_count == 0) { start_phase(a); }
+
+        double abs_a_error = steer(a, travel_angle, a.s.a[a.id]);
+
+        if (abs_a_error < M_PI / 20 || current_phase_count == 0) {current_phase_count++;}
+    }
+
+    // 32-bit draws the start of a run phase usually takes
+    static int phase_start_draws(const sim_params &sp) { return (Mode::randomize_runsteps(sp) ? 1 : 0) + Noise::draws(sp); }
+
+    // Begin a new run phase: draw its length and travel angle
+    static void start_phase(const AgentRef &a) {
+        const sim_params &sp = a.sp;
+
+        // get random runlength between 1/2 and 3/2 of provided runsteps
+        if (Mode::randomize_runsteps(sp)) {
+            int lower = std::round(sp.avg_runsteps / 2);
+            int higher = std::round(3 * sp.avg_runsteps / 2);
+            a.s.runsteps[a.id] = a.rng().get_unif_int(lower, higher);
+        }
+        else { a.s.runsteps[a.id] = sp.avg_runsteps; }
+
+        // also get travel angle
+        a.s.travel_angle[a.id] = Noise::template travel_angle<Goals, Mode>(a);
+        turn_instantly(a, a.s.travel_angle[a.id]);
+    }
+
+    void reset(int begin, int end) override {
+        reset_batch(sd->state, *sd->sp, begin, end, [this](int k) { return AgentRef(*sd, k); });
+    }
+
+    // Agents sense and check their goals a batch at a time, then decide together
+    void sensing_update(int begin, int end) override {
+        int skipped = 0;
+        auto ref = [this](int k) { return AgentRef(*sd, k); };
+        for (int first = begin; first < end; first += DECISION_BATCH_SIZE) {
+            int last = std::min(end, first + DECISION_BATCH_SIZE);
+            for (int i = first; i < last; i++) {
+                if (!AgentSteps::sense(ref(i))) { skipped++; }
+            }
+            goal_batch(*sd->sp, first, last, ref);
+            decision_batch(sd->state, *sd->sp, first, last, ref);
+        }
+        if (skipped > 0) { sd->skipped_senses += skipped; }
+    }
+
+    void position_update(int begin, int end) override {
+        bool skip_stationary = sd->sp->event_driven_sensing;
+        for (int i = begin; i < end; i++) {
+            AgentRef a(*sd, i);
+            if (skip_stationary && AgentSteps::stationary(a)) { continue; }
+            AgentSteps::move<Mode>(a);
+        }
+    }
+
+    private:
+    SimulationData *sd;
+
+    // Agents sensed before deciding together, few enough that their state is still in cache for the decisions
+    static const int DECISION_BATCH_SIZE = 256;
+
+    // Streams filled per Random::Stream::reserve call
+    static const int RNG_BATCH_SIZE = 64;
+
+    // Buffer count draws in the random streams (for this step) of the agents in slots[0 ... n - 1], all together
+    template <class MakeRef>
+    static void reserve_streams(const int *slots, int n, int count, const MakeRef &ref) {
+        Random::Stream *streams[RNG_BATCH_SIZE];
+        for (int j = 0; j < n; j++) { streams[j] = &ref(slots[j]).rng(); }
+        Random::Stream::reserve(streams, n, count);
+    }
+};
+
+
+// Call make.template build<Mode>() with the FixedMode matching the flags in sp, binding one flag at a time
+// Used once per simulation: whatever it builds assumes the flags do not change while it runs
+template <class Make, bool Periodic, bool InstantTurn, bool ConditionalNoise>
+auto with_fixed_mode(const sim_params &sp, const Make &make) {
+    if (sp.randomize_runsteps) { return make.template build<FixedMode<Periodic, InstantTurn, ConditionalNoise, true>>(); }
+    return make.template build<FixedMode<Periodic, InstantTurn, ConditionalNoise, false>>();
+}
+
+template <class Make, bool Periodic, bool InstantTurn>
+auto with_fixed_mode(const sim_params &sp, const Make &make) {
+    if (sp.conditional_noise) { return with_fixed_mode<Make, Periodic, InstantTurn, true>(sp, make); }
+    return with_fixed_mode<Make, Periodic, InstantTurn, false>(sp, make);
+}
+
+template <class Make, bool Periodic>
+auto with_fixed_mode(const sim_params &sp, const Make &make) {
+    if (sp.turnspeed == -1) { return with_fixed_mode<Make, Periodic, true>(sp, make); }
+    return with_fixed_mode<Make, Periodic, false>(sp, make);
+}
+
+template <class Make>
+auto with_fixed_mode(const sim_params &sp, const Make &make) {
+    if (sp.periodic) { return with_fixed_mode<Make, true>(sp, make); }
+    return with_fixed_mode<Make, false>(sp, make);
+}
+
+
+// Build the AgentEngine for the flags in sim_data->sp
+template <class Goals, class Noise>
+struct AgentEngineMaker {
+    SimulationData *sd;
+
+    template <class Mode>
+    AgentEngineBase *build() const { return new AgentEngine<Goals, Noise, Mode>(sd); }
+};
+
+template <class Goals, class Noise>
+AgentEngineBase *make_agent_engine(SimulationData *sim_data) {
+    return with_fixed_mode(*sim_data->sp, AgentEngineMaker<Goals, Noise>{sim_data});
+}
+
+
+#endif
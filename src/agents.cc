@@ -15,65 +15,62 @@
 // Define Agent class functions
 
 // Constructor
-Agent::Agent(int agent_id, sim_params *sim_params, SimulationData *sim_data) {
+Agent::Agent(int agent_id, sim_params *sim_params, SimulationData *sim_data) 
+{
     sp = sim_params;
     sd = sim_data;    
     id = agent_id;
-    cur_pos = new Pose();
 
+    init();
+}
+// Destructor
+Agent::~Agent(void){}
+
+// Pick a color and a random pose, as for a new agent (base class reset, as in the constructor)
+void Agent::init() {
     if (sp->gui_random_colors) {
         color = Color::RandomColor();
     }
 
     else { color =  Color(0.5, 0.5, 0.5, 0.8); } // gray
 
-    reset();
-}
-Agent::Agent() {
+    Agent::reset();
 }
 
-// Destructor
-Agent::~Agent(void){ delete cur_pos;}
-
 // Use rejection sampling to obtain a random point in a the ring between radius r_lower and r_upper (center at origin)
 // Or, if not in a circular arena, in the square with center at origin and side length 2 * r_upper
-Pose Agent::random_pos()
-{
-    bool done = 0;
-    double rand_x;
-    double rand_y;
-    double rand_a = 2 * M_PI * (Random::get_unif_double(0, 1) - .5);
-
-    while (!done) {
-        rand_x = sp->r_upper * 2 * (Random::get_unif_double(0, 1) - .5);
-        rand_y = sp->r_upper * 2 * (Random::get_unif_double(0, 1) - .5);
-        double dist = Pose(rand_x, rand_y, 0, 0).Distance(Pose(0,0,0,0));
-        if (!sp->circle_arena || (dist <= sp->r_upper && dist >= sp->r_lower)) { done = 1; }
-    }
-
-    if (sp->verbose) {
-    printf("Random Pose (x, y, angle) generated for agent %i is [%.2f %.2f %.2f] \n", id, rand_x, rand_y, rand_a);
-    }    
-
-    return Pose(rand_x, rand_y, 0, rand_a);
+Pose Agent::random_pos() {
+    return AgentSteps::random_pos(ref()).to_pose();
 }
 
 void Agent::reset() {
-    fwd_speed = 0;
-    turn_speed = 0;
-    set_pos(random_pos());
+    AgentSteps::reset(ref());
     trail.clear();
-    sensed.clear();
+}
+
+// Rekey the stream on the first draw of each step (or trial)
+Random::Stream &Agent::rng() {
+    return ref().rng();
 }
 
 // Function to set new position
 void Agent::set_pos(Pose p) {
-    *cur_pos = p;
+    sd->state.set_pos(slot(), Pose2(p));
 }
 
 // Function to get Pose
 Pose Agent::get_pos() const {
-    return *cur_pos;
+    return sd->state.get_pos(slot()).to_pose();
+}
+
+// Function to set new goal
+void Agent::set_goal(Pose p) {
+    sd->state.set_goal(slot(), Pose2(p));
+}
+
+// Function to get goal
+Pose Agent::get_goal() const {
+    return sd->state.get_goal(slot()).to_pose();
 }
 
 // Update sensor information
@@ -81,6 +78,16 @@ void Agent::sensing_update() {
 
 }
 
+// Find neighbors in vision cone
+void Agent::sense_neighbors() {
+    AgentSteps::sense(ref());
+}
+
+// React to sensor information
+void Agent::process_sensed() {
+
+}
+
 // Update the robot's intended forward and turning speed
 void Agent::decision_update() {
 
@@ -88,25 +95,9 @@ void Agent::decision_update() {
 
 //// Update robot position
 void Agent::position_update() {
-    // find the change of pose due to our forward and turning motions
-    const Pose dp(fwd_speed * sp->dt, 0, 0, normalize(turn_speed * sp->dt));
-
-    // the pose we're trying to achieve
-    Pose newpose(*cur_pos + dp);
-    set_pos(newpose);
-
-    // update location if world is periodic and robot is now out of bounds
-    if (sp->periodic) {
-        double s = 2 * sp->r_upper;
-
-        if (cur_pos->x < -s/2 || cur_pos->x > s/2 || cur_pos->y < -s/2 || cur_pos->y > s/2) { // if out of bounds
-        double x = fmod(cur_pos->x + s/2, s) - s/2;
-        double y = fmod(cur_pos->y + s/2, s) - s/2;
-        set_pos(Pose(x > -s/2 ? x : x + s, y > -s/2 ? y : y + s, cur_pos->z, cur_pos->a));
-        }
-    }
+    AgentSteps::move(ref());
     
-    if(sp->gui_draw_footprints & (fmod(sd->sim_time, 0.5) <= 0.0001)) {
+    if(sp->gui_draw_footprints & sd->footprint_interval.due(sd->step)) {
         update_trail();
     }
 }
@@ -171,104 +162,44 @@ void Agent::draw() {
 ///////////////////////////////////////////////////////////////////////////
 // Define GoalAgent class functions
 
-GoalAgent::GoalAgent(int agent_id, sim_params *sim_params, SimulationData *sim_data) : Agent(agent_id, sim_params, sim_data){
-
-}
-
-GoalAgent::GoalAgent() : Agent() {}
+GoalAgent::GoalAgent(int agent_id, sim_params *sim_params, SimulationData *sim_data) 
+    : Agent(agent_id, sim_params, sim_data) {}
 
 // Destructor
 GoalAgent::~GoalAgent(void){}
 
 void GoalAgent::reset() {
-    Agent::reset();
-
-    stop = 0;
-    goal_pos = random_pos(); // set goal
-    goal_birth_time = sd->sim_time;
-    goals_reached = 0;
-    travel_angle = 0;
+    Engine::reset_agent(ref());
+    trail.clear();
 }
 
 // make updates when robot reaches goal (increase goal counters, generate new goal, etc)
 void GoalAgent::goal_updates() {
-    goal_pos = random_pos();
-    goals_reached++;
-    // printf("Goals reached: %i \n", goals_reached);
-    goal_birth_time = sd->sim_time;
+    Engine::goal_updates(ref());
 }
 
 // Update sensor information
 void GoalAgent::sensing_update() {
-
-    // first, check if robot has reached its goal and update variables accordingly
-    if (cur_pos->Distance(goal_pos) < sp->goal_tolerance) {
-        goal_updates();
-    }
-
-    sensed = sd->sense(id, get_pos());
-    stop = sensed.size() > 0; // agent will stop if any neighbor was sensed in vision cone
-
-    decision_update();
+    Engine::sensing_update(ref());
 }
 
+// React to sensor information
+void GoalAgent::process_sensed() {
+    Engine::process_sensed(ref());
+}
 
 // Update the robot's intended forward and turning speed
 void GoalAgent::decision_update() {
-    travel_angle = angle_to_goal();
-    double a_error = normalize(travel_angle - cur_pos->a);
-    double abs_a_error = abs(a_error);
-    
-    // robots do not move forward if they are blocked or still turning
-    fwd_speed = (stop || abs_a_error > M_PI / 20) ? 0 : sp->cruisespeed;
-
-    // for instantaneous turning, set robot to travel angle
-    if (sp->turnspeed == -1) {
-      set_pos(Pose(cur_pos->x, cur_pos->y, cur_pos->z, travel_angle));
-      turn_speed = 0;
-    }
-    // for non-instantaneous turning, set turnspeed
-    else {
-        // use full turn speed until we are close to the final angle
-        turn_speed = abs_a_error > M_PI / 10 ? sp->turnspeed * (a_error / abs_a_error) : sp->turnspeed * a_error;
-    }
+    Engine::decision_update(ref());
 }
 
-
 //// Get (global) angle robot should move in to head straight to goal
 double GoalAgent::angle_to_goal() {
-      Pose goal_pos_helper; // will be true goal pos if world is not periodic
-      if (!sp->periodic) {
-        goal_pos_helper = goal_pos;
-      }
-
-      // if space is periodic, figure out where robot should move to for shortest path to goal
-      else {
-            goal_pos_helper = nearest_periodic(get_pos(), goal_pos, sp->r_upper);
-      }
-      
-      double x_error = goal_pos_helper.x - cur_pos->x;
-      double y_error = goal_pos_helper.y - cur_pos->y;
-
-      return atan2(y_error, x_error);
+    return RandomGoals::angle_to_goal(ref());
 }
 
-
 double GoalAgent::dist_to_goal() {
-    Pose goal_pos_helper; // will be true goal pos if world is not periodic
-    if (!sp->periodic) {
-      goal_pos_helper = goal_pos;
-    }
-
-    // if space is periodic, figure out where robot should move to for shortest path to goal
-    else {
-          goal_pos_helper = nearest_periodic(get_pos(), goal_pos, sp->r_upper);
-    }
-    
-    double x_error = goal_pos_helper.x - cur_pos->x;
-    double y_error = goal_pos_helper.y - cur_pos->y;
-
-    return std::sqrt(x_error * x_error + y_error * y_error);
+    return RandomGoals::dist_to_goal(ref());
 }
 
 // Draw goals
@@ -277,7 +208,7 @@ void GoalAgent::draw() {
 
     // draw small point at robot goal
     glPushMatrix(); 
-        pose_shift(goal_pos);
+        pose_shift(get_goal());
             // glColor4f(1, 0, .8, .7); // magenta
             if(sp->gui_random_colors) {
                 glColor4f(color.r, color.g, color.b, 0.7);
@@ -301,74 +232,35 @@ void GoalAgent::draw() {
 ConstNoiseAgent::ConstNoiseAgent(int agent_id, sim_params *sim_params, SimulationData *sim_data) 
     : GoalAgent(agent_id, sim_params, sim_data) {}
 
-ConstNoiseAgent::ConstNoiseAgent() : GoalAgent() {}
 
 // Destructor
 ConstNoiseAgent::~ConstNoiseAgent(void){}
 
 void ConstNoiseAgent::reset() {
-    GoalAgent::reset();
-    current_phase_count = 0;
+    Engine::reset_agent(ref());
+    trail.clear();
 }
 
 void ConstNoiseAgent::goal_updates() {
-    GoalAgent::goal_updates();
-    current_phase_count = 0;
+    Engine::goal_updates(ref());
+}
+
+void ConstNoiseAgent::sensing_update() {
+    Engine::sensing_update(ref());
+}
+
+void ConstNoiseAgent::process_sensed() {
+    Engine::process_sensed(ref());
 }
 
 // Determine angle for robot to steer in (after adding noise)
 double ConstNoiseAgent::get_travel_angle() {
-    // float b = 
-    return angle_to_goal() + (sp->anglenoise == -1 ? Random::get_unif_double(-M_PI, M_PI) : Random::get_normal_double(sp->anglebias, sp->anglenoise));
+    return ConstNoise::travel_angle<RandomGoals>(ref());
 }
 
 // Update the robot's intended forward and turning speed
 void ConstNoiseAgent::decision_update() {
-    // check if current run phase is over
-    if (current_phase_count >= runsteps) {
-        current_phase_count = 0;
-    }
-
-    if (current_phase_count == 0) {
-        // if a new run phase is beginning, get random runlength between 1/2 and 3/2 of provided runsteps
-        if (sp->randomize_runsteps) {
-            int lower = std::round(sp->avg_runsteps / 2);
-            int higher = std::round(3 * sp->avg_runsteps / 2);
-            runsteps = Random::get_unif_int(lower, higher);
-
-        }
-        else {runsteps = sp->avg_runsteps;}
-
-        // also get travel angle
-        travel_angle = get_travel_angle();
-        
-        // for instantaneous turning, set robot to travel angle
-        if (sp->turnspeed == -1) {
-            Pose cur_pos = get_pos();
-            set_pos(Pose(cur_pos.x, cur_pos.y, cur_pos.z, travel_angle));
-            turn_speed = 0;
-        }
-    }
-
-    double a_error = normalize(travel_angle - get_pos().a);
-    double abs_a_error = abs(a_error);
-
-    // fwd_speed = stop ? 0 : sp->cruisespeed;
-    fwd_speed = (stop || abs_a_error > M_PI / 20) ? 0 : sp->cruisespeed;
-
-    // for non-instantaneous turning, set turnspeed
-    if (sp->turnspeed != -1) {
-        // turn_speed = sp->turnspeed * a_error;
-
-        // use full turn speed until we are close to the final angle
-        turn_speed = abs_a_error > M_PI / 10 ? sp->turnspeed * (a_error / abs_a_error) : sp->turnspeed * a_error;
-
-    }
-
-    // current_phase_count++;
-    if (abs_a_error < M_PI / 20 || current_phase_count == 0) {current_phase_count++;}
-
-    // printf("agent: %i; travel angle: %f, phase step: %i, a_error: %f, fwd speed: %f, turn speed: %f \n", id, travel_angle, current_phase_count, a_error, fwd_speed, turn_speed);
+    Engine::decision_update(ref());
 }
 
 
@@ -380,23 +272,33 @@ void ConstNoiseAgent::decision_update() {
 NoiseAgent::NoiseAgent(int agent_id, sim_params *sim_params, SimulationData *sim_data) 
     : ConstNoiseAgent(agent_id, sim_params, sim_data) {}
 
-NoiseAgent::NoiseAgent() : ConstNoiseAgent() {}
 
 // Destructor
 NoiseAgent::~NoiseAgent(void){}
 
+void NoiseAgent::reset() {
+    Engine::reset_agent(ref());
+    trail.clear();
+}
+
+void NoiseAgent::goal_updates() {
+    Engine::goal_updates(ref());
+}
+
+void NoiseAgent::sensing_update() {
+    Engine::sensing_update(ref());
+}
+
+void NoiseAgent::process_sensed() {
+    Engine::process_sensed(ref());
+}
+
 // Determine angle for robot to steer in (after adding noise)
 double NoiseAgent::get_travel_angle() {
-    double without_noise = angle_to_goal();
-    double with_noise = ConstNoiseAgent::get_travel_angle();
-
-    if (!(sp->conditional_noise) || stop) { // unless conditional noise is on and robot is free to move,
-    // add noise to motion with noise_prob probability
-        if (Random::get_unif_double(0, 1) <= sp->noise_prob) {
-            return with_noise;
-        }
-    }
+    return ConditionalNoise::travel_angle<RandomGoals>(ref());
+}
 
-    // otherwise head directly to goal
-    return without_noise;
-}
\ No newline at end of file
+// Update the robot's intended forward and turning speed
+void NoiseAgent::decision_update() {
+    Engine::decision_update(ref());
+}
@@ -7,34 +7,57 @@
 #include "../shared_utils.hh"
 #include <deque>
 
+#include "agent_engine.hh"
+
 class SimulationData;
 
 // Base Agent class
 // An agent with sensing abilities and a location
+// Agent state lives in the SimulationData agent store, at the agent's slot, and the steps themselves are in agent_engine.hh
+// SimulationManager steps every agent through an AgentEngine; these classes are thin wrappers kept for the GUI and for
+// stepping a single agent
 class Agent {
     public:
-    Pose goal_pos;
     int id;
     sim_params *sp;
     SimulationData *sd;
-    Pose *cur_pos;
     Color color;
 
     // store recent poses
     std::deque<Pose> trail;
 
-    // store information about neighbors detected in FOV
-    std::vector<sensor_result> sensed;
+    // The agent's slot in the store, which changes when SimulationData renumbers the agents
+    // (so the views below are looked up on every call, not kept)
+    int slot() const { return sd->agent_store_slot[id]; }
+
+    // store information about neighbors detected in FOV (views into the agent store, with neighbors by slot)
+    // only filled in when sd->record_sensed is set; sensed_any is always up to date
+    std::vector<sensor_result> &sensed() const { return sd->state.sensed[slot()]; }
+    char &sensed_any() const { return sd->state.sensed_any[slot()]; }
 
-    // current speeds
-    double fwd_speed; // meters per second
-    double turn_speed; // radians per second
+    // current speeds (views into the agent store)
+    real_t &fwd_speed() const { return sd->state.fwd_speed[slot()]; } // meters per second
+    real_t &turn_speed() const { return sd->state.turn_speed[slot()]; } // radians per second
+
+    // This agent's random stream for the current step, keyed by (sp->seed, sd->trial, id, sd->step)
+    // Draws do not depend on any other agent, so decisions can be made on any thread
+    Random::Stream &rng();
 
     virtual void reset();
 
+    // Set the agent up as its constructor does, for reusing it in a new world (SimulationManager::reconfigure)
+    void init();
+
     // Update sensor information
     virtual void sensing_update();
 
+    // Check for neighbors currently in the vision cone, filling sensed if sd->record_sensed is set
+    // Only reads other agents' positions, so it is safe to run for all agents in parallel
+    void sense_neighbors();
+
+    // React to the contents of sensed (goal checks, stop flag, decision update)
+    virtual void process_sensed();
+
     // Update the robot's intended forward and turning speed
     virtual void decision_update();
 
@@ -47,6 +70,12 @@ class Agent {
     /// Update current position
     Pose get_pos() const;
 
+    /// Update current goal
+    void set_goal(Pose p);
+
+    /// Get current goal
+    Pose get_goal() const;
+
     //// Use rejection sampling to get a random point in a the ring or square between radius r_lower and r_upper (center at origin)
     Pose random_pos();
 
@@ -57,22 +86,25 @@ class Agent {
 
     // Constructor
     Agent(int agent_id, sim_params *sim_params, SimulationData *sim_data);
-    Agent();
 
     // Destructor
-    ~Agent();
+    virtual ~Agent();
+
+    protected:
+    AgentRef ref() const { return AgentRef(*sd, slot()); }
 };
 
 
 // A robot which navigates directly to randomly generated individual goals
 class GoalAgent : public Agent {
     public:
-    // Pose goal_pos;
-    radians_t travel_angle;
+    typedef AgentEngine<RandomGoals, NoNoise> Engine;
 
-    int goals_reached;
-    uint64_t goal_birth_time;
-    bool stop = 0;
+    // travel angle, goal counters and stop flag (views into the agent store)
+    real_t &travel_angle() const { return sd->state.travel_angle[slot()]; }
+    int &goals_reached() const { return sd->state.goals_reached[slot()]; }
+    uint64_t &goal_birth_time() const { return sd->state.goal_birth_time[slot()]; }
+    char &stop() const { return sd->state.stop[slot()]; }
 
     // //// Set up waypoint storage (used to visualize next goal)
     // virtual void gen_waypoint_data();
@@ -86,6 +118,9 @@ class GoalAgent : public Agent {
     // Update the robot's intended forward and turning speed
     virtual void sensing_update() override;
 
+    // Check for goal arrival, set stop from sensed_any and update the robot's intended speeds
+    virtual void process_sensed() override;
+
     // Update the robot's intended forward and turning speed
     virtual void decision_update() override;
 
@@ -99,7 +134,6 @@ class GoalAgent : public Agent {
 
     // Constructor
     GoalAgent(int agent_id, sim_params *sim_params, SimulationData *sim_data);
-    GoalAgent();
 
     // Destructor
     ~GoalAgent();
@@ -109,12 +143,14 @@ class GoalAgent : public Agent {
 // A robot which navigates to randomly generated individual goals, adding noise to the direction of its motion every time it chooses a new direction
 class ConstNoiseAgent : public GoalAgent {
     public:
-    int current_phase_count, runsteps; // time so far spent running or tumbling, total length of a run or tumble period
-    double travel_angle; // amount of noise and bias to add to random angles
+    typedef AgentEngine<RandomGoals, ConstNoise> Engine;
+
+    // time so far spent running or tumbling, total length of a run or tumble period (views into the agent store)
+    int &current_phase_count() const { return sd->state.phase_count[slot()]; }
+    int &runsteps() const { return sd->state.runsteps[slot()]; }
 
     //// Constructor
     ConstNoiseAgent(int agent_id, sim_params *sim_params, SimulationData *sim_data);
-    ConstNoiseAgent();
 
     //// Destructor
     ~ConstNoiseAgent();
@@ -122,8 +158,11 @@ class ConstNoiseAgent : public GoalAgent {
     //// Reset robot data for a new trial
     virtual void reset() override;
 
-    // // Update the robot's intended forward and turning speed
-    // virtual void sensing_update() override;
+    // Update the robot's intended forward and turning speed
+    virtual void sensing_update() override;
+
+    // Check for goal arrival, set stop from sensed_any and update the robot's intended speeds
+    virtual void process_sensed() override;
 
     // Update the robot's intended forward and turning speed
     virtual void decision_update() override;
@@ -138,19 +177,31 @@ class ConstNoiseAgent : public GoalAgent {
 // A robot which navigates to randomly generated individual goals, sometimes adding noise to the direction of its motion
 class NoiseAgent : public ConstNoiseAgent {
     public:
-    int current_phase_count, runsteps; // time so far spent running or tumbling, total length of a run or tumble period
-    double travel_angle; // amount of noise and bias to add to random angles
+    typedef AgentEngine<RandomGoals, ConditionalNoise> Engine;
 
     //// Constructor
     NoiseAgent(int agent_id, sim_params *sim_params, SimulationData *sim_data);
-    NoiseAgent();
 
     //// Destructor
     ~NoiseAgent();
 
+    //// Reset robot data for a new trial
+    virtual void reset() override;
+
+    // Update the robot's intended forward and turning speed
+    virtual void sensing_update() override;
+
+    // Check for goal arrival, set stop from sensed_any and update the robot's intended speeds
+    virtual void process_sensed() override;
+
+    // Update the robot's intended forward and turning speed
+    virtual void decision_update() override;
+
     //// Determine angle for robot to steer in (after adding noise)
     virtual double get_travel_angle() override;
 
+    virtual void goal_updates() override;
+
 };
 
 
@@ -7,6 +7,7 @@ Canvas::Canvas(SimulationManager *simulation, int x, int y, int width, int heigh
     _x = 0;
     _y = 0;
     paused = true;
+    draw_interval = TickInterval(std::max(1, sim->sp.gui_draw_every));
 }
 
 Canvas::~Canvas() {
@@ -40,12 +41,7 @@ void Canvas::draw() {
 
     // Draw cells
     if (sim->sp.use_cell_lists & sim->sp.gui_draw_cells) {
-        for (const auto& row : sim->sd->cells) {
-            for (Cell *c : row) {
-                c->draw();
-            }
-        }
-
+        sim->sd->draw_cells();
     }
 
     // Draw boundaries of periodic arena
@@ -60,31 +56,39 @@ void Canvas::draw() {
     }
 
 
-    // update simulation
-    if (!paused) { 
-        sim->update(); 
-        // // keep resetting simulation (to test reset functions)
-        // if (sim->sd->sim_time > 60) {
-        //     sim->reset();
-        // }
-    }
-
     // // // Swap buffers to display the rendered content
     // glFlush();
     // swap_buffers();
 
-    redraw();
+}
+
+// Advance the simulation to the next step a redraw is due on
+void Canvas::step_to_next_frame() {
+    do {
+        sim->update();
+    } while (!draw_interval.due(sim->sd->step));
+
+    // // keep resetting simulation (to test reset functions)
+    // if (sim->sd->sim_time > 60) {
+    //     sim->reset();
+    // }
+}
 
+// Simulated time between redraws, in wall clock seconds
+double Canvas::frame_period() const {
+    return draw_interval.ticks * sim->sp.dt / sim->sp.gui_speedup;
 }
 
+// One frame: step the simulation (unless paused) and redraw it
 void Canvas::TimerCallback(void* userdata) {
     Canvas* this_canvas = (Canvas*)userdata;
+    if (!this_canvas->paused) { this_canvas->step_to_next_frame(); }
     this_canvas->redraw();
-    Fl::repeat_timeout(this_canvas->sim->sp.dt / this_canvas->sim->sp.gui_speedup, TimerCallback, userdata);  // Adjust the interval as needed
+    Fl::repeat_timeout(this_canvas->frame_period(), TimerCallback, userdata);
 }
 
 void Canvas::startAnimation() {
-    Fl::add_timeout(sim->sp.dt / sim->sp.gui_speedup, TimerCallback, this);  // Start the animation loop
+    Fl::add_timeout(frame_period(), TimerCallback, this);  // Start the animation loop
 }
 
 int Canvas::handle(int event) {
@@ -27,11 +27,16 @@ class Canvas : public Fl_Gl_Window {
 
     SimulationManager *sim;
 
+    /** Steps between redraws (sp.gui_draw_every) */
+    TickInterval draw_interval;
+
     void draw() override;
     int handle(int event) override;
 
     static void TimerCallback(void* userdata);
     void startAnimation();
+    void step_to_next_frame();
+    double frame_period() const;
 
 };
 
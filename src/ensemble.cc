@@ -0,0 +1,225 @@
+#include "ensemble.hh"
+#include "agent_engine.hh"
+
+// Agents of a replica screened by each call to vision_cone_batch when sensing
+static const int ENSEMBLE_SENSE_BATCH_SIZE = 64;
+
+
+// The step of every replica, with NoiseAgent's policies and the given Mode
+template <class Mode>
+class EnsembleStepper : public EnsembleStepperBase {
+    public:
+    typedef AgentEngine<RandomGoals, ConditionalNoise, Mode> Engine;
+
+    EnsembleStepper(Ensemble *ensemble) : e(ensemble) {}
+
+    void reset(int begin, int end) override {
+        for (int r = begin; r < end; r++) {
+            Engine::reset_batch(e->state, e->worlds[e->replica_world[r]], e->first[r], e->first[r + 1],
+                                [this, r](int k) { return ref(r, k); });
+        }
+    }
+
+    // Each replica's agents sense and check their goals, then decide together
+    void sensing_update(int begin, int end) override {
+        for (int r = begin; r < end; r++) {
+            const sim_params &sp = e->worlds[e->replica_world[r]];
+            auto replica_ref = [this, r](int k) { return ref(r, k); };
+            for (int k = e->first[r]; k < e->first[r + 1]; k++) { sense(ref(r, k), e->first[r], e->first[r + 1]); }
+            Engine::goal_batch(sp, e->first[r], e->first[r + 1], replica_ref);
+            Engine::decision_batch(e->state, sp, e->first[r], e->first[r + 1], replica_ref);
+        }
+    }
+
+    void position_update(int begin, int end) override {
+        for (int r = begin; r < end; r++) {
+            for (int k = e->first[r]; k < e->first[r + 1]; k++) { AgentSteps::move<Mode>(ref(r, k)); }
+        }
+    }
+
+    private:
+    Ensemble *e;
+
+    AgentRef ref(int r, int k) const {
+        return AgentRef(e->worlds[e->replica_world[r]], e->state, k, k - e->first[r], e->replica_trial[r], e->step, e->sim_time);
+    }
+
+    // Find the neighbors in the vision cone among the agents in slots [begin, end) (the agent's own replica)
+    // Same results as SimulationData::sense and sense_any, with sensed ids relative to begin
+    void sense(const AgentRef &a, int begin, int end) {
+        const sim_params &sp = a.sp;
+        const AgentStore &s = a.s;
+        Pose2 agent_pos = s.get_pos(a.id);
+        std::vector<sensor_result> &sensed = a.s.sensed[a.id];
+        sensed.clear();
+        bool any = false;
+
+        cone_query q = make_cone_query(agent_pos, sp.sensing_range, sp.sensing_angle, Mode::periodic(sp), sp.r_upper);
+        unsigned char in_cone[ENSEMBLE_SENSE_BATCH_SIZE];
+
+        for (int k = begin; k < end && !any; k += ENSEMBLE_SENSE_BATCH_SIZE) {
+            int batch = std::min(ENSEMBLE_SENSE_BATCH_SIZE, end - k);
+            vision_cone_batch(q, &s.x[k], &s.y[k], batch, in_cone);
+
+            for (int j = 0; j < batch; j++) {
+                int nbr = k + j;
+                if (!in_cone[j] || nbr == a.id) { continue; }
+
+                if (!e->record_sensed) {
+                    // the full list is not needed, so stop at the first neighbor found
+                    any = true;
+                    break;
+                }
+
+                // test the hit carefully for its distance
+                Pose2 nbr_pos(s.x[nbr], s.y[nbr], 0);
+                if (Mode::periodic(sp)) { nbr_pos = nearest_periodic(agent_pos, nbr_pos, sp.r_upper); }
+
+                cone_result cr = in_vision_cone(agent_pos, nbr_pos, sp.sensing_range, sp.sensing_angle);
+                if (cr.in_cone) {
+                    sensor_result new_result;
+                    new_result.dist_away = cr.dist_away;
+                    new_result.id = nbr - begin;
+                    sensed.push_back(new_result);
+                }
+            }
+        }
+
+        a.s.sensed_any[a.id] = e->record_sensed ? sensed.size() > 0 : any;
+    }
+};
+
+
+struct EnsembleStepperMaker {
+    Ensemble *e;
+
+    template <class Mode>
+    EnsembleStepperBase *build() const { return new EnsembleStepper<Mode>(e); }
+};
+
+// Specialise the step on the worlds' flags when they all agree, otherwise read each world's flags as it goes
+static EnsembleStepperBase *make_ensemble_stepper(Ensemble *e) {
+    const sim_params &sp0 = e->worlds[0];
+    for (const sim_params &sp : e->worlds) {
+        if (sp.periodic != sp0.periodic || (sp.turnspeed == -1) != (sp0.turnspeed == -1) ||
+            sp.conditional_noise != sp0.conditional_noise || sp.randomize_runsteps != sp0.randomize_runsteps) {
+            return new EnsembleStepper<RuntimeMode>(e);
+        }
+    }
+    return with_fixed_mode(sp0, EnsembleStepperMaker{e});
+}
+
+
+// Constructor
+Ensemble::Ensemble(const std::vector<sim_params> &world_params, int num_trials) {
+    worlds = world_params;
+    trials = num_trials;
+
+    // Warnings about incompatible parameter settings
+    for (sim_params &sp : worlds) {
+        if (sp.dt != worlds[0].dt || sp.save_data_interval != worlds[0].save_data_interval || sp.outfile_name != worlds[0].outfile_name) {
+            sp.dt = worlds[0].dt;
+            sp.save_data_interval = worlds[0].save_data_interval;
+            sp.outfile_name = worlds[0].outfile_name;
+            if (worlds[0].verbose) {
+                printf("Warning: all worlds in an ensemble step and save together, so they must share dt, save_data_interval and outfile_name.\n");
+            }
+        }
+
+        // Master seed for the agents' random streams
+        if (sp.seed == 0) { sp.seed = Random::generate_seed(); }
+        if (sp.verbose) { printf("Master seed: %llu \n", (unsigned long long)sp.seed); }
+    }
+
+    // Lay out the replicas world by world
+    first.push_back(0);
+    for (int w = 0; w < (int)worlds.size(); w++) {
+        for (int t = 0; t < trials; t++) {
+            replica_world.push_back(w);
+            replica_trial.push_back(t);
+            first.push_back(first.back() + worlds[w].num_agents);
+        }
+    }
+    state.resize(first.back());
+
+    sim_time = 0;
+    step = 0;
+    end_step = 0;
+    save_interval = TickInterval::from_seconds(worlds[0].save_data_interval, worlds[0].dt);
+    record_sensed = true;
+
+    pool = worlds[0].num_threads > 1 ? new WorkerPool(worlds[0].num_threads) : nullptr;
+    stepper = make_ensemble_stepper(this);
+}
+
+// Destructor
+Ensemble::~Ensemble() {
+    delete stepper;
+    delete pool;
+}
+
+
+void Ensemble::reset() {
+    sim_time = 0; // needs to happen first since agents store this time as goal_birth_time
+    step = 0; // and key their random streams by the step
+    end_step = 0;
+    stepper->reset(0, num_replicas());
+}
+
+
+// Same step as SimulationManager::update(), for every replica at once
+// Positions do not change until every agent has sensed and decided, so the replicas can be split across the pool
+void Ensemble::update() {
+    step++;
+    sim_time = step * (double)worlds[0].dt;
+    record_sensed = save_due();
+
+    if (pool) {
+        pool->parallel_for(num_replicas(), [this](int begin, int end) { stepper->sensing_update(begin, end); });
+        pool->parallel_for(num_replicas(), [this](int begin, int end) { stepper->position_update(begin, end); });
+    }
+    else {
+        stepper->sensing_update(0, num_replicas());
+        stepper->position_update(0, num_replicas());
+    }
+}
+
+
+void Ensemble::run(double trial_length) {
+    const sim_params &sp = worlds[0];
+
+    // Set up outfile for saving data
+    if (!sp.outfile_name.empty()) {
+        outfile << std::fixed << std::setprecision(2);
+        outfile.open(sp.outfile_name, std::ios_base::app);
+    }
+
+    reset();
+    end_step = steps_to_reach(trial_length, sp.dt);
+    while (step < end_step) {
+
+        if (save_due()) {
+            save_data();
+        }
+
+        update();
+    }
+
+    if (!sp.outfile_name.empty()) { save_data(); }
+
+    // close outfile
+    if (!sp.outfile_name.empty()) { outfile.close(); }
+}
+
+
+// As in SimulationManager, the final state is saved even when the trial length is not a multiple of the save interval
+bool Ensemble::save_due() {
+    return !worlds[0].outfile_name.empty() && (save_interval.due(step) || (end_step > 0 && step == end_step));
+}
+
+
+void Ensemble::save_data() {
+    for (int r = 0; r < num_replicas(); r++) {
+        save_agent_rows(outfile, worlds[replica_world[r]], replica_trial[r], sim_time, state, first[r]);
+    }
+}
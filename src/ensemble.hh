@@ -0,0 +1,83 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <vector>
+#include <fstream>
+
+#include "simulation_manager.hh"
+
+
+class EnsembleStepperBase;
+
+// Many small independent worlds, stepped side by side
+// Each replica is one trial of one world. The agents of every replica share one AgentStore (replica r owns slots
+// first[r] ... first[r + 1] - 1), and all replicas advance through the same step loop, each reading its own world's
+// sim_params (cruisespeed, turnspeed, anglenoise, num_agents, ...).
+// Meant for worlds of a few dozen agents, where a SimulationManager spends most of each step maintaining a near-empty
+// neighbor grid: here a replica's agents are screened all at once with vision_cone_batch, whatever the neighbor search
+// settings say.
+// Saves the same data as running SimulationManager(world_params[w]).run_trials(trials, ...) for each world in turn,
+// with the rows in a different order.
+class Ensemble {
+    public:
+    // Constructor: one replica for every trial of every world
+    // All worlds must share dt, save_data_interval and outfile_name (the first world's are used)
+    Ensemble(const std::vector<sim_params> &world_params, int trials);
+    // Destructor
+    ~Ensemble();
+
+    std::vector<sim_params> worlds; // with seeds resolved
+    int trials; // trials per world
+
+    // replica r is trial replica_trial[r] of world replica_world[r]
+    std::vector<int> replica_world;
+    std::vector<int> replica_trial;
+    std::vector<int> first; // first agent slot of each replica (num_replicas + 1 entries)
+
+    /** state of every agent of every replica */
+    AgentStore state;
+
+    double sim_time; // step * dt
+    uint64_t step; // steps since the last reset
+    uint64_t end_step; // last step of the current run, whose state is always saved (0 if not known)
+    TickInterval save_interval; // worlds[0].save_data_interval, in steps
+    bool record_sensed; // fill in full sensed lists (only needed when the state after this step will be saved)
+
+    std::ofstream outfile;
+
+    /** Worker threads for splitting the replicas (worlds[0].num_threads), or nullptr */
+    WorkerPool *pool;
+
+    int num_replicas() const { return replica_world.size(); }
+
+    // Run every trial of every world for trial_length seconds
+    void run(double trial_length);
+    void reset();
+    void update();
+    void save_data();
+
+    // Whether the current state is due to be saved
+    bool save_due();
+
+    private:
+    EnsembleStepperBase *stepper;
+};
+
+
+// Steps a range of replicas (see make_ensemble_stepper in ensemble.cc)
+class EnsembleStepperBase {
+    public:
+    virtual ~EnsembleStepperBase() {}
+
+    // Reset replicas [begin, end) for a new trial
+    virtual void reset(int begin, int end) = 0;
+
+    // Sense, check goals and choose new speeds for the agents of replicas [begin, end)
+    virtual void sensing_update(int begin, int end) = 0;
+
+    // Move the agents of replicas [begin, end)
+    virtual void position_update(int begin, int end) = 0;
+};
+
+
+#endif
@@ -0,0 +1,77 @@
+#include <numeric>
+#include "kd_tree.hh"
+
+
+void KdTree::build(const real_t *xs, const real_t *ys, int n, int leaf_size) {
+    ids.resize(n);
+    std::iota(ids.begin(), ids.end(), 0);
+    nodes.clear();
+    if (n == 0) { return; }
+
+    build_node(xs, ys, 0, n, std::max(leaf_size, 1));
+    refit(xs, ys);
+}
+
+
+int KdTree::build_node(const real_t *xs, const real_t *ys, int begin, int end, int leaf_size) {
+    int i = nodes.size();
+    nodes.push_back(Node{0, 0, 0, 0, begin, end, -1});
+    if (end - begin <= leaf_size) { return i; }
+
+    // split along the wider side of the bounding box
+    double lo_x = xs[ids[begin]], hi_x = lo_x, lo_y = ys[ids[begin]], hi_y = lo_y;
+    for (int k = begin + 1; k < end; k++) {
+        lo_x = std::min<double>(lo_x, xs[ids[k]]);
+        hi_x = std::max<double>(hi_x, xs[ids[k]]);
+        lo_y = std::min<double>(lo_y, ys[ids[k]]);
+        hi_y = std::max<double>(hi_y, ys[ids[k]]);
+    }
+    const real_t *coord = (hi_x - lo_x >= hi_y - lo_y) ? xs : ys;
+
+    int mid = begin + (end - begin) / 2;
+    std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end,
+                     [coord](int a, int b) { return coord[a] < coord[b]; });
+
+    build_node(xs, ys, begin, mid, leaf_size); // left child, at i + 1
+    int right = build_node(xs, ys, mid, end, leaf_size);
+    nodes[i].right = right;
+    return i;
+}
+
+
+void KdTree::refit(const real_t *xs, const real_t *ys) {
+    int n = ids.size();
+    px.resize(n);
+    py.resize(n);
+    for (int k = 0; k < n; k++) {
+        px[k] = xs[ids[k]];
+        py[k] = ys[ids[k]];
+    }
+
+    // children come after their parent, so a backwards pass fits them first
+    for (int i = (int)nodes.size() - 1; i >= 0; i--) { fit_node(i); }
+}
+
+
+void KdTree::fit_node(int i) {
+    Node &node = nodes[i];
+
+    if (node.right < 0) {
+        node.lo_x = node.hi_x = px[node.begin];
+        node.lo_y = node.hi_y = py[node.begin];
+        for (int k = node.begin + 1; k < node.end; k++) {
+            node.lo_x = std::min<double>(node.lo_x, px[k]);
+            node.hi_x = std::max<double>(node.hi_x, px[k]);
+            node.lo_y = std::min<double>(node.lo_y, py[k]);
+            node.hi_y = std::max<double>(node.hi_y, py[k]);
+        }
+        return;
+    }
+
+    const Node &left = nodes[i + 1];
+    const Node &right = nodes[node.right];
+    node.lo_x = std::min(left.lo_x, right.lo_x);
+    node.hi_x = std::max(left.hi_x, right.hi_x);
+    node.lo_y = std::min(left.lo_y, right.lo_y);
+    node.hi_y = std::max(left.hi_y, right.hi_y);
+}
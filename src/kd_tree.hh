@@ -0,0 +1,83 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <vector>
+#include <algorithm>
+#include "../shared_utils.hh"
+
+// k-d tree over agent positions, for neighbor search in crowded, clustered worlds
+// Regions are split at the median along their wider side until each leaf holds at most leaf_size agents,
+// so in a jam a query only screens the agents right around it (a uniform grid screens every occupant of each nearby cell)
+// Nodes are stored depth first (a node's left child comes right after it), and each leaf's agents are packed
+// together in ids, px and py, ready for vision_cone_batch
+class KdTree {
+    public:
+    struct Node {
+        double lo_x, lo_y, hi_x, hi_y; // bounding box of the node's agents
+        int begin, end; // the node's agents are ids[begin] ... ids[end - 1]
+        int right; // index of the right child, or -1 for a leaf
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> ids; // agent ids in leaf order
+    std::vector<real_t> px, py; // positions of the agents in ids
+
+    // Build a new tree over the positions (xs[i], ys[i]) of agents 0 ... n - 1
+    void build(const real_t *xs, const real_t *ys, int n, int leaf_size);
+
+    // Keep the tree's shape and agent order, but refresh the packed positions and bounding boxes
+    // Queries stay exact, they only get slower as agents drift away from where the tree was built
+    void refit(const real_t *xs, const real_t *ys);
+
+    // Call f(leaf) for each leaf whose bounding box comes within r of (qx, qy)
+    // If span > 0, positions are periodic with period span in x and y, and the nearest image of each box is used
+    // f returns true to stop early; the return value says whether it did
+    template <typename F>
+    bool for_each_leaf_near(double qx, double qy, double r, double span, F f) const {
+        if (nodes.empty()) { return false; }
+
+        // distance from q to the interval [lo, hi] along one axis
+        auto axis_dist = [span](double q, double lo, double hi) {
+            double d = std::max(0.0, std::max(lo - q, q - hi));
+            if (span > 0) {
+                d = std::min(d, std::max(0.0, std::max(lo - (q + span), (q + span) - hi)));
+                d = std::min(d, std::max(0.0, std::max(lo - (q - span), (q - span) - hi)));
+            }
+            return d;
+        };
+
+        int stack[MAX_DEPTH];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const Node &node = nodes[stack[--top]];
+            double dx = axis_dist(qx, node.lo_x, node.hi_x);
+            double dy = axis_dist(qy, node.lo_y, node.hi_y);
+            if (dx * dx + dy * dy > r * r) { continue; }
+
+            if (node.right < 0) {
+                if (f(node)) { return true; }
+                continue;
+            }
+
+            int left = &node - nodes.data() + 1;
+            stack[top++] = node.right;
+            stack[top++] = left;
+        }
+
+        return false;
+    }
+
+    private:
+    // Median splits keep the tree balanced, so its depth stays far below this for any number of agents an int can count
+    static const int MAX_DEPTH = 128;
+
+    // Build the subtree over ids[begin] ... ids[end - 1], returning its index in nodes
+    int build_node(const real_t *xs, const real_t *ys, int begin, int end, int leaf_size);
+
+    // Set the bounding box of nodes[i] from its agents or its children
+    void fit_node(int i);
+};
+
+#endif
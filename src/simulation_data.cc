@@ -1,246 +1,964 @@
+#include <algorithm>
+#include <numeric>
+#include <tuple>
 #include "utils.hh"
 #include "agents.hh"
+#include "worker_pool.hh"
+
+// Smallest number of agents for which the cell grid is built with the worker pool
+// (below this, waking the workers costs more than the counting sort itself)
+static const int PARALLEL_CELL_SORT_MIN_AGENTS = 4096;
+
+// Spare slots left in each cell for incremental updates: a fixed minimum plus a fraction of the occupants
+static const int CELL_SLACK_MIN = 2;
+static const int CELL_SLACK_DIVISOR = 4;
+
+// Entries an insertion sort of agents_byx_vec may shift per agent before handing over to std::sort
+static const int SORT_SHIFT_BUDGET_PER_AGENT = 8;
+
+// Occupants of a cell screened by each call to vision_cone_batch when sensing
+static const int SENSE_BATCH_SIZE = 64;
+
+// Extra radius kept in each Verlet list so rounding in the distance tests can never drop a neighbor
+static const meters_t VERLET_ROUNDING_MARGIN = 1e-9;
+
+// Extra radius for k-d tree queries, for the same reason (box distances and cone tests round differently near seams)
+static const meters_t KD_ROUNDING_MARGIN = 1e-9;
 
 // Constructor
 SimulationData::SimulationData(sim_params *sim_params) 
-    : cells(sim_params->cells_per_side, std::vector<Cell *>(sim_params->cells_per_side))
+    : sp(sim_params), stencil_reach(1), stencil_range(-1), stencil_cell_width(-1), stencil_angle(-1), pool(nullptr)
 {
-    sp = sim_params;
+    reconfigure();
+}
+
+// Size everything for the current parameters, reusing the storage of the previous world
+// (assign and resize keep a vector's capacity, so only growing past the largest world so far allocates)
+void SimulationData::reconfigure() {
     sim_time = 0;
+    step = 0;
+    end_step = 0;
+    save_interval = TickInterval::from_seconds(sp->save_data_interval, sp->dt);
+    footprint_interval = TickInterval::from_seconds(FOOTPRINT_INTERVAL, sp->dt);
+    trial = 0;
+    record_sensed = true;
+
+    num_cells = 0;
+    hashed_cells = false;
+    cell_rehashes = 0;
+    overflow_cell = 0;
+    last_cell_migrations = 0;
+    total_cell_migrations = 0;
+    cell_rebuilds = 0;
+    verlet_cutoff = -1;
+    verlet_builds = 0;
+    verlet_total_length = 0;
+    verlet_avg_length = 0;
+    num_domains = 1;
+    domain_migrations = 0;
+    skipped_senses = 0;
+
+    // allocate agent state
+    state.resize(sp->num_agents);
+    slot_agent.resize(sp->num_agents);
+    std::iota(slot_agent.begin(), slot_agent.end(), 0);
+    agent_store_slot = slot_agent;
+    domain_first = {0, sp->num_agents};
+
+    agents_byx_vec.clear();
+    if (sp->use_sorted_agents) {
+        agents_byx_vec.resize(sp->num_agents);
+        std::iota(agents_byx_vec.begin(), agents_byx_vec.end(), 0);
+    }
 
     // initialize cell lists
     if (sp->use_cell_lists) {
         init_cell_lists();
     }
-}
 
-// Destructor
-SimulationData::~SimulationData() {
-
-    for (const auto& row : cells) {
-        for (Cell *c : row) {
-            delete c;
-        }
+    cell_changed.clear();
+    sensed_from.clear();
+    if (sp->event_driven_sensing && sp->use_cell_lists) {
+        cell_changed.assign(num_cells, 1);
+        sensed_from.resize(sp->num_agents);
     }
-    delete overflow_cell;
 }
 
+// Destructor
+SimulationData::~SimulationData() {}
+
 // Reset
 void SimulationData::reset() {
     // all_stopped = false;
     sim_time = 0;
+    step = 0;
+
+    // new poses: share the strips out again
+    if (sp->domain_decomposition) {
+        domain_migrations = 0;
+        partition_domains();
+    }
 
-    // ensure agent lists are sorted
+    // ensure agent list is sorted
     if (sp->use_sorted_agents) {
-        std::sort(agents_byx_vec.begin(), agents_byx_vec.end(), ltx());
-        std::sort(agents_byy_vec.begin(), agents_byy_vec.end(), lty());
+        std::sort(agents_byx_vec.begin(), agents_byx_vec.end(), ltx{&state});
     }
 
     // populate cell lists
     if (sp->use_cell_lists) {
+        update_cone_stencil();
+        last_cell_migrations = 0;
+        total_cell_migrations = 0;
+        cell_rebuilds = 0;
+        cell_rehashes = 0;
+        if (hashed_cells) { rehash_cells(); }
         populate_cell_lists();
     }
+
+    // new poses: everyone senses on the first step
+    if (sp->event_driven_sensing && sp->use_cell_lists) {
+        std::fill(sensed_from.begin(), sensed_from.end(), Pose2(NAN, NAN, NAN));
+    }
+    skipped_senses = 0;
+
+    if (sp->use_kd_tree) {
+        kd_tree.build(state.x.data(), state.y.data(), state.size(), sp->kd_leaf_size);
+    }
+
+    if (sp->use_verlet_lists) {
+        verlet_builds = 0;
+        verlet_total_length = 0;
+        build_verlet_lists();
+    }
 }
 
 
 // function objects for comparing model positions
-bool SimulationData::ltx::operator()(const Agent *a, const Agent *b) const
+bool SimulationData::ltx::operator()(int a, int b) const
 {
-  const meters_t ax(a->get_pos().x);
-  const meters_t bx(b->get_pos().x);
-  // break ties using the pointer value to give a unique ordering
+  const meters_t ax(s->x[a]);
+  const meters_t bx(s->x[b]);
+  // break ties using the id to give a unique ordering
   return (ax == bx ? a < b : ax < bx);
 }
 
-bool SimulationData::lty::operator()(const Agent *a, const Agent *b) const
-{
-  const meters_t ay(a->get_pos().y);
-  const meters_t by(b->get_pos().y);
-  // break ties using the pointer value ro give a unique ordering
-  return (ay == by ? a < b : ay < by);
+// Insertion sort is close to linear on the nearly sorted list, but agents wrapping across a periodic seam
+// have to travel the whole list, so past a budget of shifted entries the rest is left to std::sort
+// (ties are broken by id, so both give the same order)
+void SimulationData::sort_agents_byx() {
+    ltx less{&state};
+    std::vector<int> &v = agents_byx_vec;
+    int64_t budget = (int64_t)SORT_SHIFT_BUDGET_PER_AGENT * v.size();
+
+    for (size_t i = 1; i < v.size(); i++) {
+        int id = v[i];
+        size_t j = i;
+        while (j > 0 && less(id, v[j - 1])) {
+            v[j] = v[j - 1];
+            j--;
+            if (--budget < 0) {
+                v[j] = id;
+                std::sort(v.begin(), v.end(), less);
+                return;
+            }
+        }
+        v[j] = id;
+    }
 }
 
 // update fields
 void SimulationData::update() {
-    // sort the position lists
+    // re-sort the position list, which agents' small moves leave nearly sorted
+    if (sp->use_sorted_agents) { sort_agents_byx(); }
+
+    // hand agents that crossed into another strip over to its domain, before the cells are updated
+    if (sp->domain_decomposition) { migrate_agents(); }
+
+    // update cell occupancy
+    // since agents move slowly, the incremental update only has to touch the few that changed cell
+    if (sp->use_cell_lists) {
+        if (sp->event_driven_sensing) { mark_changed_cells(); }
+        if (sp->incremental_cell_lists) { update_cell_lists(); }
+        else { populate_cell_lists(); }
+        update_cone_stencil();
+    }
+
+    if (sp->use_kd_tree) { update_kd_tree(); }
+
+    // Verlet lists only need rebuilding every few steps
+    if (sp->use_verlet_lists) { update_verlet_lists(); }
+
+    if (sp->renumber_interval > 0 && step % sp->renumber_interval == 0) { renumber_agents(); }
+
+    step++;
+    sim_time = step * (double)sp->dt;
+}
+
+// Interleave the bits of two cell coordinates, flipping the sign bits so that negative coordinates come first
+static uint64_t morton_key(int idx, int idy) {
+    auto spread = [](uint64_t v) {
+        v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v << 2)) & 0x3333333333333333ULL;
+        v = (v | (v << 1)) & 0x5555555555555555ULL;
+        return v;
+    };
+    return (spread((uint32_t)idx ^ 0x80000000u) << 1) | spread((uint32_t)idy ^ 0x80000000u);
+}
+
+// Agents move slowly, so agents that start out close in the store stay close in space for many steps, and the
+// cell walks, Verlet lists and k-d tree leaves of nearby agents read nearby memory
+// The cell grid and sorted agents are rebuilt on the new slots; the k-d tree and Verlet lists only have their ids
+// renamed, keeping their build schedules (the search results do not depend on the numbering)
+// With domain decomposition, the curve is followed within each domain, so the store stays laid out strip by strip
+void SimulationData::renumber_agents() {
+    int n = state.size();
+
+    // sort the slots along the curve through the cells at cell_width (ties keep their current order)
+    std::vector<std::tuple<int, uint64_t, int>> keys(n);
+    for (int i = 0; i < n; i++) {
+        int domain = sp->domain_decomposition ? domain_of(state.x[i]) : 0;
+        keys[i] = {domain, morton_key(hashed_coord(state.x[i]), hashed_coord(state.y[i])), i};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<int> order(n);
+    for (int k = 0; k < n; k++) { order[k] = std::get<2>(keys[k]); }
+    reorder_agents(order);
+}
+
+
+void SimulationData::reorder_agents(const std::vector<int> &order) {
+    int n = state.size();
+    std::vector<int> new_slot(n);
+    for (int k = 0; k < n; k++) { new_slot[order[k]] = k; }
+
+    state.permute(order);
+    for (int k = 0; k < n; k++) {
+        for (sensor_result &r : state.sensed[k]) { r.id = new_slot[r.id]; }
+    }
+
+    std::vector<int> old_slot_agent = slot_agent;
+    for (int k = 0; k < n; k++) {
+        slot_agent[k] = old_slot_agent[order[k]];
+        agent_store_slot[slot_agent[k]] = k;
+    }
+
     if (sp->use_sorted_agents) {
-        std::sort(agents_byx_vec.begin(), agents_byx_vec.end(), ltx());
-        std::sort(agents_byy_vec.begin(), agents_byy_vec.end(), lty());
+        for (int &id : agents_byx_vec) { id = new_slot[id]; }
+        std::sort(agents_byx_vec.begin(), agents_byx_vec.end(), ltx{&state});
     }
 
-    // update cell occupancy
-    // a performance update for later: since agents move slowly, 
     if (sp->use_cell_lists) {
+        // the cells themselves are unchanged, so the changed-cell flags of this step still hold
+        if (sp->event_driven_sensing) {
+            std::vector<Pose2> old_sensed_from = sensed_from;
+            for (int k = 0; k < n; k++) { sensed_from[k] = old_sensed_from[order[k]]; }
+        }
         populate_cell_lists();
     }
 
-    sim_time += sp->dt;
+    // the tree packs its own copy of the positions in leaf order, so only the ids change
+    if (sp->use_kd_tree) {
+        for (int &id : kd_tree.ids) { id = new_slot[id]; }
+    }
+
+    // lay the lists out again in the new slot order
+    if (sp->use_verlet_lists && !verlet_start.empty()) {
+        std::vector<int> old_start = verlet_start, old_nbrs = verlet_nbrs;
+        std::vector<real_t> old_x = verlet_x, old_y = verlet_y;
+        for (int k = 0; k < n; k++) {
+            int i = order[k];
+            verlet_start[k + 1] = verlet_start[k] + old_start[i + 1] - old_start[i];
+            for (int j = old_start[i]; j < old_start[i + 1]; j++) { verlet_nbrs[verlet_start[k] + j - old_start[i]] = new_slot[old_nbrs[j]]; }
+            verlet_x[k] = old_x[i];
+            verlet_y[k] = old_y[i];
+        }
+    }
+}
+
+
+// Columns are handed out left to right, closing a strip once it holds its share of the agents, so clustered worlds
+// still split evenly (as long as no single column holds more than a share)
+void SimulationData::partition_domains() {
+    int n = state.size();
+    int cps = sp->cells_per_side;
+    num_domains = std::max(1, std::min(pool ? pool->num_threads : 1, cps));
+
+    std::vector<int> column_count(cps, 0);
+    for (int k = 0; k < n; k++) { column_count[column_of(state.x[k])]++; }
+
+    // every strip gets at least one column
+    column_domain.assign(cps, 0);
+    int d = 0, columns = 0;
+    int64_t seen = 0;
+    for (int c = 0; c < cps; c++) {
+        bool full = seen >= (int64_t)n * (d + 1) / num_domains;
+        bool no_spare_columns = cps - c == num_domains - 1 - d;
+        if (d < num_domains - 1 && columns > 0 && (full || no_spare_columns)) {
+            d++;
+            columns = 0;
+        }
+        column_domain[c] = d;
+        columns++;
+        seen += column_count[c];
+    }
+
+    // counting sort of the slots by domain (agents keep their order within a domain)
+    domain_first.assign(num_domains + 1, 0);
+    for (int k = 0; k < n; k++) { domain_first[domain_of(state.x[k]) + 1]++; }
+    std::partial_sum(domain_first.begin(), domain_first.end(), domain_first.begin());
+
+    std::vector<int> order(n);
+    std::vector<int> next(domain_first.begin(), domain_first.end() - 1);
+    for (int k = 0; k < n; k++) { order[next[domain_of(state.x[k])]++] = k; }
+    reorder_agents(order);
+}
+
+
+// Each domain looks for its own emigrants; handing them over only touches the agents that crossed, and one agent at
+// the edge of each domain they pass through
+void SimulationData::migrate_agents() {
+    domain_emigrants.resize(num_domains);
+    auto find_emigrants = [this](int d) {
+        std::vector<int> &emigrants = domain_emigrants[d];
+        emigrants.clear();
+        for (int k = domain_first[d]; k < domain_first[d + 1]; k++) {
+            if (domain_of(state.x[k]) != d) { emigrants.push_back(slot_agent[k]); }
+        }
+    };
+
+    if (num_domains > 1) {
+        pool->parallel_for(num_domains, [&](int begin, int end) { for (int d = begin; d < end; d++) { find_emigrants(d); } });
+    }
+    else { find_emigrants(0); }
+
+    // an agent crosses one domain boundary at a time: it is swapped to the edge of its domain's slots, and the
+    // boundary is moved past it. Swaps move other agents to new slots, but never into another domain, so emigrants
+    // are listed by agent id
+    for (int from = 0; from < num_domains; from++) {
+        for (int agent : domain_emigrants[from]) {
+            int k = agent_store_slot[agent];
+            int to = domain_of(state.x[k]);
+            for (int d = from; d < to; d++) {
+                int last = domain_first[d + 1] - 1;
+                swap_slots(k, last);
+                k = last;
+                domain_first[d + 1]--;
+            }
+            for (int d = from; d > to; d--) {
+                int first = domain_first[d];
+                swap_slots(k, first);
+                k = first;
+                domain_first[d]++;
+            }
+            domain_migrations++;
+        }
+    }
+}
+
+
+// Sensed lists are not remapped: every sensing update writes them again
+void SimulationData::swap_slots(int i, int j) {
+    if (i == j) { return; }
+
+    state.swap_agents(i, j);
+    std::swap(slot_agent[i], slot_agent[j]);
+    agent_store_slot[slot_agent[i]] = i;
+    agent_store_slot[slot_agent[j]] = j;
+
+    if (sp->use_cell_lists) {
+        cell_agents[agent_slot[i]] = j;
+        cell_agents[agent_slot[j]] = i;
+        std::swap(agent_slot[i], agent_slot[j]);
+        std::swap(agent_cell[i], agent_cell[j]);
+        if (sp->event_driven_sensing) { std::swap(sensed_from[i], sensed_from[j]); }
+    }
 }
 
+
+int SimulationData::num_agent_blocks() const {
+    if (sp->domain_decomposition) { return num_domains; }
+    return (pool && state.size() >= PARALLEL_CELL_SORT_MIN_AGENTS) ? pool->num_threads : 1;
+}
+
+int SimulationData::agent_block_begin(int b, int num_blocks) const {
+    if (sp->domain_decomposition) { return domain_first[b]; }
+    return (int)((int64_t)state.size() * b / num_blocks);
+}
+
+
+// Rebuild the cell grid with a two-pass counting sort
+// Each thread counts the cells of a contiguous block of agents (its own domain's, with domain decomposition), then
+// scatters that block into place, so the occupants of every cell stay in id order whether or not the pool is used
+// With incremental cell lists, each cell is given spare slots for agents moving in later
 void SimulationData::populate_cell_lists() {
-    // clear all current cell occupants
-    for (const auto& row : cells) {
-        for (Cell *c : row) {
-            c->occupants.clear();
+    int n = state.size();
+
+    // hashed cells are kept until some agent wanders into a cell that does not exist
+    // (their lookups are done here, once, rather than in the counting passes)
+    if (hashed_cells) {
+        for (int i = 0; i < n; i++) {
+            agent_cell_key[i] = hashed_key(state.x[i], state.y[i]);
+            agent_cell[i] = hashed_cell(agent_cell_key[i]);
+            if (agent_cell[i] < 0) {
+                rehash_cells();
+                i = -1; // look the cells up again
+            }
+        }
+    }
+
+    int num_blocks = num_agent_blocks();
+    cell_counts.assign((size_t)num_blocks * num_cells, 0);
+
+    auto block_begin = [this, num_blocks](int b) { return agent_block_begin(b, num_blocks); };
+
+    // pass 1: find each agent's cell and count the occupants of each cell
+    auto count_block = [&](int b) {
+        int *counts = &cell_counts[(size_t)b * num_cells];
+        for (int i = block_begin(b); i < block_begin(b + 1); i++) {
+            int c = hashed_cells ? agent_cell[i] : get_cell_for_pos(state.x[i], state.y[i]);
+            agent_cell[i] = c;
+            counts[c]++;
+        }
+    };
+
+    // pass 2: place each agent at the next free slot of its cell
+    auto scatter_block = [&](int b) {
+        int *offsets = &cell_counts[(size_t)b * num_cells];
+        for (int i = block_begin(b); i < block_begin(b + 1); i++) {
+            int slot = offsets[agent_cell[i]]++;
+            cell_agents[slot] = i;
+            agent_slot[i] = slot;
+            cell_x[slot] = state.x[i];
+            cell_y[slot] = state.y[i];
+        }
+    };
+
+    if (num_blocks > 1) {
+        pool->parallel_for(num_blocks, [&](int begin, int end) { for (int b = begin; b < end; b++) { count_block(b); } });
+    }
+    else { count_block(0); }
+
+    // prefix sum over cells, then over blocks within a cell, turns the counts into scatter offsets
+    int offset = 0;
+    for (int c = 0; c < num_cells; c++) {
+        cell_start[c] = offset;
+        for (int b = 0; b < num_blocks; b++) {
+            int count = cell_counts[(size_t)b * num_cells + c];
+            cell_counts[(size_t)b * num_cells + c] = offset;
+            offset += count;
+        }
+        cell_end[c] = offset;
+
+        if (sp->incremental_cell_lists) {
+            offset += CELL_SLACK_MIN + (cell_end[c] - cell_start[c]) / CELL_SLACK_DIVISOR;
+        }
+    }
+    cell_start[num_cells] = offset;
+    cell_agents.resize(offset);
+    cell_x.resize(offset);
+    cell_y.resize(offset);
+    cell_rebuilds++;
+
+    if (num_blocks > 1) {
+        pool->parallel_for(num_blocks, [&](int begin, int end) { for (int b = begin; b < end; b++) { scatter_block(b); } });
+    }
+    else { scatter_block(0); }
+}
+
+
+// The scans over every agent are split into blocks for the worker pool; the moves between cells are made in order
+void SimulationData::update_cell_lists() {
+    int num_blocks = num_agent_blocks();
+    migrating.resize(num_blocks);
+
+    auto run_blocks = [&](const auto &f) {
+        if (num_blocks > 1) {
+            pool->parallel_for(num_blocks, [&](int begin, int end) { for (int b = begin; b < end; b++) { f(b); } });
+        }
+        else { f(0); }
+    };
+
+    // find the agents that crossed into a different cell (including wrapping across a periodic boundary)
+    run_blocks([&](int b) {
+        migrating[b].clear();
+        for (int i = agent_block_begin(b, num_blocks); i < agent_block_begin(b + 1, num_blocks); i++) {
+            bool left_cell = hashed_cells
+                ? hashed_key(state.x[i], state.y[i]) != agent_cell_key[i]
+                : get_cell_for_pos(state.x[i], state.y[i]) != agent_cell[i];
+            if (left_cell) { migrating[b].push_back(i); }
+        }
+    });
+
+    last_cell_migrations = 0;
+    for (const std::vector<int> &block : migrating) { last_cell_migrations += block.size(); }
+    total_cell_migrations += last_cell_migrations;
+
+    for (const std::vector<int> &block : migrating) {
+        for (int i : block) {
+            int old_cell = agent_cell[i];
+            int new_cell = get_cell_for_pos(state.x[i], state.y[i]);
+
+            // out of spare slots in the new cell, or past the hashed cells: rebuild everything with fresh slack
+            if (new_cell < 0 || cell_end[new_cell] == cell_start[new_cell + 1]) {
+                populate_cell_lists();
+                return;
+            }
+
+            // remove from the old cell by moving its last occupant into this agent's slot
+            int slot = agent_slot[i];
+            int last = cell_agents[--cell_end[old_cell]];
+            cell_agents[slot] = last;
+            agent_slot[last] = slot;
+
+            // append to the new cell
+            cell_agents[cell_end[new_cell]] = i;
+            agent_slot[i] = cell_end[new_cell]++;
+            agent_cell[i] = new_cell;
+            if (hashed_cells) { agent_cell_key[i] = hashed_key(state.x[i], state.y[i]); }
+        }
+    }
+
+    // every agent may have moved within its cell, so refresh all packed positions
+    run_blocks([&](int b) {
+        for (int i = agent_block_begin(b, num_blocks); i < agent_block_begin(b + 1, num_blocks); i++) {
+            cell_x[agent_slot[i]] = state.x[i];
+            cell_y[agent_slot[i]] = state.y[i];
+        }
+    });
+}
+
+
+// Compare each agent with its packed position from the last update to find the agents that moved
+void SimulationData::mark_changed_cells() {
+    std::fill(cell_changed.begin(), cell_changed.end(), 0);
+    for (int i = 0; i < state.size(); i++) {
+        int slot = agent_slot[i];
+        if (state.x[i] != cell_x[slot] || state.y[i] != cell_y[slot]) {
+            cell_changed[agent_cell[i]] = 1;
+
+            // a hashed cell that does not exist yet is flagged by the rehash that creates it
+            int new_cell = get_cell_for_pos(state.x[i], state.y[i]);
+            if (new_cell >= 0) { cell_changed[new_cell] = 1; }
         }
     }
-    overflow_cell->occupants.clear();
+}
+
 
-    // iterate through agents and make them occupants of the correct cell
-    for (Agent *a : agents) 
-        {
-            Cell *cur_cell = get_cell_for_pos(a->cur_pos);
-            cur_cell->occupants.push_back(a);
+void SimulationData::update_kd_tree() {
+    if (sp->kd_rebuild_interval <= 1 || step % sp->kd_rebuild_interval == 0) {
+        kd_tree.build(state.x.data(), state.y.data(), state.size(), sp->kd_leaf_size);
     }
+    else { kd_tree.refit(state.x.data(), state.y.data()); }
 }
 
 
-Cell* SimulationData::get_cell_for_pos(Pose *p) {
+int SimulationData::get_cell_for_pos(meters_t x, meters_t y) const {
+    if (hashed_cells) { return hashed_cell(hashed_key(x, y)); }
+
     meters_t cr = sp->cells_range;
     meters_t cw = sp->cell_width;
+    int cps = sp->cells_per_side;
 
     // if out of cell range, return overflow
-    if (p->x < -1.0 * cr || p->x >= cr || p->y < -1.0 * cr || p->y >= cr) {
-        // printf("in overflow \n");
+    if (x < -1.0 * cr || x >= cr || y < -1.0 * cr || y >= cr) {
         return overflow_cell;
     }
     else {
-        meters_t dist_from_left = p->x - (-1.0 * cr);
+        meters_t dist_from_left = x - (-1.0 * cr);
         int idx = floor(dist_from_left / cw);
 
-        meters_t dist_from_bottom = p->y - (-1.0 * cr);
+        meters_t dist_from_bottom = y - (-1.0 * cr);
         int idy = floor(dist_from_bottom / cw);
 
-        // printf("idx: %i, idy: %i \n", idx, idy);
+        // guard against rounding up to the cell past the top/right edge
+        idx = std::min(idx, cps - 1);
+        idy = std::min(idy, cps - 1);
 
-        return cells[idx][idy];
+        return idx * cps + idy;
     }
 }
 
 void SimulationData::init_cell_lists() {
-    overflow_cell = new Cell(sp->cells_range, -1.0 * sp->cells_range, sp->cells_range, -1.0 * sp->cells_range);
-    overflow_cell->is_outer_cell = false;
-    overflow_cell->is_overflow_cell = true;
-
-    float cur_x = -1.0 * sp->cells_range;
-
-    // set bounds for each cell
-    // cells[0][0] is in the bottom left
-    // idx = a, idy = b is the 0-indexed cell which is ath from the left and bth from the bottom 
-    for (int idx = 0; idx < sp->cells_per_side; idx++) {
-        float cur_y = -1.0 * sp->cells_range;
-        for (int idy = 0; idy < sp->cells_per_side; idy++) {
-            cells[idx][idy] = new Cell(cur_x, cur_x + sp->cell_width, cur_y, cur_y + sp->cell_width);
-            cells[idx][idy]->is_outer_cell = (idx == 0 || idy == 0 || 
-                                            idx == sp->cells_per_side - 1 || idy == sp->cells_per_side - 1);
-            cells[idx][idy]->is_overflow_cell = false;
-
-            cur_y += sp->cell_width;
+    hashed_cells = sp->hashed_cell_lists && !sp->periodic;
+    if (hashed_cells) {
+        // the cells are laid out around the agents by rehash_cells
+        num_cells = 0;
+        overflow_cell = -1;
+        cell_start.assign(1, 0);
+        cell_end.clear();
+        cell_agents.assign(state.size(), 0);
+        cell_x.assign(state.size(), 0);
+        cell_y.assign(state.size(), 0);
+        agent_cell.assign(state.size(), 0);
+        agent_slot.assign(state.size(), 0);
+        agent_cell_key.assign(state.size(), 0);
+        return;
+    }
+
+    int cps = sp->cells_per_side;
+
+    // cells_per_side^2 grid cells, plus the overflow cell at the end
+    num_cells = cps * cps + 1;
+    overflow_cell = cps * cps;
+
+    cell_start.assign(num_cells + 1, 0);
+    cell_end.assign(num_cells, 0);
+    cell_agents.assign(state.size(), 0);
+    cell_x.assign(state.size(), 0);
+    cell_y.assign(state.size(), 0);
+    agent_cell.assign(state.size(), overflow_cell);
+    agent_slot.assign(state.size(), 0);
+}
+
+int SimulationData::hashed_cell(uint64_t key) const {
+    auto it = cell_index.find(key);
+    return it == cell_index.end() ? -1 : it->second;
+}
+
+// Create the cell of every agent and of its eight neighbors, numbered in order of their coordinates
+// Cells nobody is near any more are dropped, so the number of cells stays below 9 * num_agents
+void SimulationData::rehash_cells() {
+    std::vector<std::pair<int, int>> coords;
+    coords.reserve(9 * state.size());
+    for (int i = 0; i < state.size(); i++) {
+        int idx = hashed_coord(state.x[i]);
+        int idy = hashed_coord(state.y[i]);
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) { coords.push_back({idx + dx, idy + dy}); }
         }
-        cur_x += sp->cell_width;
+    }
+    std::sort(coords.begin(), coords.end());
+    coords.erase(std::unique(coords.begin(), coords.end()), coords.end());
+
+    num_cells = coords.size();
+    cell_index.clear();
+    cell_index.reserve(num_cells);
+    hashed_cell_info.resize(num_cells);
+    for (int c = 0; c < num_cells; c++) {
+        hashed_cell_info[c].ix = coords[c].first;
+        hashed_cell_info[c].iy = coords[c].second;
+        cell_index[cell_key(coords[c].first, coords[c].second)] = c;
     }
 
-    // populate each cell's vector of cell neighbors
-    // each cell initializes the linking for its neighbor to the top, right, and upper diagonals (if those cells exists)
-    for (int idx = 0; idx < sp->cells_per_side; idx++) {
-        for (int idy = 0; idy < sp->cells_per_side; idy++) {
-            // link to neighbor on right
-            cell_neighbor_helper(idx, idy, idx + 1, idy);
+    for (HashedCell &hc : hashed_cell_info) {
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) { hc.nbrs[(dx + 1) * 3 + dy + 1] = hashed_cell(hc.ix + dx, hc.iy + dy); }
+        }
+    }
 
-            // link to neighbor above
-            cell_neighbor_helper(idx, idy, idx, idy + 1);
+    cell_start.assign(num_cells + 1, 0);
+    cell_end.assign(num_cells, 0);
 
-            // link to upper right diagonal neighbor
-            cell_neighbor_helper(idx, idy, idx + 1, idy + 1);
+    // the cells were renumbered, so every agent has to sense again
+    if (sp->event_driven_sensing) { cell_changed.assign(num_cells, 1); }
+    cell_rehashes++;
+}
 
-            // link to upper left diagonal neighbor
-            cell_neighbor_helper(idx, idy, idx - 1, idy + 1);
+// Whether the rectangle [xmin, xmax] x [ymin, ymax] overlaps the cone with its apex at the origin,
+// pointing along heading with half-width half_angle and radius range
+static bool rect_intersects_cone(double xmin, double xmax, double ymin, double ymax, 
+                                 double heading, double half_angle, double range) 
+{
+    // the apex is in the rectangle
+    if (xmin <= 0 && 0 <= xmax && ymin <= 0 && 0 <= ymax) { return true; }
+
+    // a full disk: compare the closest point of the rectangle to the range
+    if (half_angle >= M_PI) {
+        double cx = std::min(std::max(0.0, xmin), xmax);
+        double cy = std::min(std::max(0.0, ymin), ymax);
+        return cx * cx + cy * cy <= range * range;
+    }
 
-            // link to overflow cell
-            if (cells[idx][idy]->is_outer_cell) {
-                // link to overflow cell
-                cells[idx][idy]->add_neighbor(overflow_cell);
-                overflow_cell->add_neighbor(cells[idx][idy]);
+    // wide cones are not convex, so test each half separately
+    if (half_angle > M_PI / 2) {
+        return rect_intersects_cone(xmin, xmax, ymin, ymax, heading - half_angle / 2, half_angle / 2, range) ||
+               rect_intersects_cone(xmin, xmax, ymin, ymax, heading + half_angle / 2, half_angle / 2, range);
+    }
+
+    // clip the rectangle to the wedge between the two edge rays of the cone
+    std::vector<std::pair<double, double>> poly = {{xmin, ymin}, {xmax, ymin}, {xmax, ymax}, {xmin, ymax}};
+    double lo = heading - half_angle;
+    double hi = heading + half_angle;
+
+    // keep the part of poly where side(p) >= 0 (Sutherland-Hodgman)
+    auto clip = [&poly](auto side) {
+        std::vector<std::pair<double, double>> out;
+        for (size_t i = 0; i < poly.size(); i++) {
+            auto p = poly[i];
+            auto q = poly[(i + 1) % poly.size()];
+            double sp = side(p);
+            double sq = side(q);
+            if (sp >= 0) { out.push_back(p); }
+            if ((sp >= 0) != (sq >= 0)) {
+                double t = sp / (sp - sq);
+                out.push_back({p.first + t * (q.first - p.first), p.second + t * (q.second - p.second)});
             }
         }
+        poly = out;
+    };
+
+    clip([lo](std::pair<double, double> p) { return cos(lo) * p.second - sin(lo) * p.first; }); // left of the low edge
+    clip([hi](std::pair<double, double> p) { return sin(hi) * p.first - cos(hi) * p.second; }); // right of the high edge
+    if (poly.empty()) { return false; }
+
+    // the apex is outside the clipped polygon, so its closest point is on an edge
+    for (size_t i = 0; i < poly.size(); i++) {
+        auto p = poly[i];
+        auto q = poly[(i + 1) % poly.size()];
+        double ex = q.first - p.first;
+        double ey = q.second - p.second;
+        double len2 = ex * ex + ey * ey;
+        double t = len2 > 0 ? std::min(std::max(-(p.first * ex + p.second * ey) / len2, 0.0), 1.0) : 0;
+        double cx = p.first + t * ex;
+        double cy = p.second + t * ey;
+        if (cx * cx + cy * cy <= range * range) { return true; }
     }
+
+    return false;
 }
 
+void SimulationData::update_cone_stencil() {
+    if (!sp->use_cone_stencil) { return; }
+    if (stencil_range == sp->sensing_range && stencil_angle == sp->sensing_angle && stencil_cell_width == sp->cell_width) { return; }
+    build_cone_stencil();
+}
 
-// add the two cells as neighbors (two-way) if they are a valid pair (handling periodic cell wrapping)
-void SimulationData::cell_neighbor_helper(int idx, int idy, int nbr_idx, int nbr_idy) {
-    int cps = sp->cells_per_side;
-    // if neighbor cell is beyond cell array bounds, only add them (after wrapping) if simulation is periodic
-    if (nbr_idx >= cps || nbr_idx < 0 || nbr_idy >= cps || nbr_idy < 0) {
-        if (sp->periodic) {
-                Cell *wrapped_nbr = cells[(nbr_idx + cps) % cps][(nbr_idy + cps) % cps];
-                cells[idx][idy]->add_neighbor(wrapped_nbr);
-                wrapped_nbr->add_neighbor(cells[idx][idy]);
+// For every heading sector and sub-cell, list the cell offsets that some agent in that sub-cell,
+// heading anywhere in that sector, could see into. The test is conservative, so sensing results do not change.
+void SimulationData::build_cone_stencil() {
+    stencil_range = sp->sensing_range;
+    stencil_angle = sp->sensing_angle;
+    stencil_cell_width = sp->cell_width;
+
+    meters_t cw = sp->cell_width;
+    meters_t sub_width = cw / STENCIL_SUBCELLS;
+    radians_t sector_width = 2 * M_PI / STENCIL_HEADING_SECTORS;
+    stencil_reach = std::max(1, (int)ceil(sp->sensing_range / cw));
+
+    // small margins so rounding never drops a cell
+    meters_t eps = 1e-9 * cw;
+    meters_t range = sp->sensing_range + eps;
+    radians_t half_angle = sp->sensing_angle / 2.0 + sector_width / 2.0 + 1e-9;
+
+    stencil_start.clear();
+    stencil_dx.clear();
+    stencil_dy.clear();
+
+    for (int sector = 0; sector < STENCIL_HEADING_SECTORS; sector++) {
+        radians_t heading = -M_PI + (sector + 0.5) * sector_width;
+
+        for (int subx = 0; subx < STENCIL_SUBCELLS; subx++) {
+            for (int suby = 0; suby < STENCIL_SUBCELLS; suby++) {
+                stencil_start.push_back(stencil_dx.size());
+
+                // offsets from anywhere in the sub-cell to anywhere in the target cell span a rectangle
+                std::vector<std::pair<double, std::pair<int, int>>> offsets; // (closest distance, (dx, dy))
+                for (int dx = -stencil_reach; dx <= stencil_reach; dx++) {
+                    for (int dy = -stencil_reach; dy <= stencil_reach; dy++) {
+                        double xmin = dx * cw - (subx + 1) * sub_width - eps;
+                        double xmax = (dx + 1) * cw - subx * sub_width + eps;
+                        double ymin = dy * cw - (suby + 1) * sub_width - eps;
+                        double ymax = (dy + 1) * cw - suby * sub_width + eps;
+
+                        if (!rect_intersects_cone(xmin, xmax, ymin, ymax, heading, half_angle, range)) { continue; }
+
+                        double cx = std::min(std::max(0.0, xmin), xmax);
+                        double cy = std::min(std::max(0.0, ymin), ymax);
+                        offsets.push_back({cx * cx + cy * cy, {dx, dy}});
+                    }
+                }
+
+                // nearest cells first, so early-exit queries hit sooner
+                std::stable_sort(offsets.begin(), offsets.end(), 
+                    [](const auto &a, const auto &b) { return a.first < b.first; });
+                for (const auto &o : offsets) {
+                    stencil_dx.push_back(o.second.first);
+                    stencil_dy.push_back(o.second.second);
+                }
+            }
         }
     }
+    stencil_start.push_back(stencil_dx.size());
 
-    // otherwise make the cells neighbors as normal
-    else {
-        cells[idx][idy]->add_neighbor(cells[nbr_idx][nbr_idy]);
-        cells[nbr_idx][nbr_idy]->add_neighbor(cells[idx][idy]);
+    if (sp->verbose) {
+        int num_keys = stencil_start.size() - 1;
+        printf("Cone stencil: %.2f of %i cells searched per agent on average \n", 
+            (double)stencil_dx.size() / num_keys, (2 * stencil_reach + 1) * (2 * stencil_reach + 1));
     }
-
 }
 
-// Find nearby agents to a given position
-std::vector<Agent *> SimulationData::find_nearby_sorted_agents(Pose *agent_pos) {
-    std::vector<Agent *> nearby_sorted_agents;
+void SimulationData::update_verlet_lists() {
+    if (verlet_cutoff != sp->sensing_range + sp->verlet_skin + VERLET_ROUNDING_MARGIN) {
+        build_verlet_lists();
+        return;
+    }
 
-    // vecs_sorted(); // test whether the position vectors are sorted
-    
-    if (sp->use_sorted_agents) {
-        double rng = sp->sensing_range;
-        Pose *gp = agent_pos;
-        Agent edge(-1, sp, this); // dummy model used to find bounds in the sets
-        std::vector<Agent *>::iterator xmin, xmax, ymin, ymax;
+    // a pair outside the list radius at the last build cannot get within sensing range
+    // until the two agents have moved more than verlet_skin between them
+    meters_t half_skin = sp->verlet_skin / 2.0;
+    for (int i = 0; i < state.size(); i++) {
+        Pose2 cur_pos(state.x[i], state.y[i], 0);
+        Pose2 built_pos(verlet_x[i], verlet_y[i], 0);
+        if (sp->periodic) { built_pos = nearest_periodic(cur_pos, built_pos, sp->r_upper); }
+
+        if (cur_pos.Distance(built_pos) > half_skin) {
+            build_verlet_lists();
+            return;
+        }
+    }
+}
 
-        edge.set_pos(Pose(gp->x - rng, gp->y, 0, 0)); // LEFT
-        xmin = std::lower_bound(agents_byx_vec.begin(), agents_byx_vec.end(), &edge, ltx());
+// Find each agent's neighbors within sensing_range + verlet_skin, searching the cells within that radius
+// (or every agent, without cell lists). Each thread lists the neighbors of a contiguous block of agents,
+// so the lists come out the same whether or not the pool is used
+void SimulationData::build_verlet_lists() {
+    int n = state.size();
+    int cps = sp->cells_per_side;
+    meters_t cw = sp->cell_width;
+    meters_t cr = sp->cells_range;
+    meters_t cutoff = sp->sensing_range + sp->verlet_skin + VERLET_ROUNDING_MARGIN;
+    int num_blocks = (pool && n >= PARALLEL_CELL_SORT_MIN_AGENTS) ? pool->num_threads : 1;
+
+    verlet_cutoff = cutoff;
+    verlet_x = state.x;
+    verlet_y = state.y;
+    verlet_start.assign(n + 1, 0);
+    verlet_block_nbrs.resize(num_blocks);
+
+    auto block_begin = [n, num_blocks](int b) { return (int)((int64_t)n * b / num_blocks); };
+
+    auto build_block = [&](int b) {
+        std::vector<int> &nbrs = verlet_block_nbrs[b];
+        nbrs.clear();
+
+        for (int i = block_begin(b); i < block_begin(b + 1); i++) {
+            Pose2 agent_pos(state.x[i], state.y[i], 0);
+            int list_begin = nbrs.size();
+
+            auto test_nbr = [&](int j) {
+                if (j == i) { return; }
+                Pose2 nbr_pos(state.x[j], state.y[j], 0);
+                if (sp->periodic) { nbr_pos = nearest_periodic(agent_pos, nbr_pos, sp->r_upper); }
+                if (agent_pos.Distance(nbr_pos) < cutoff) { nbrs.push_back(j); }
+            };
+
+            auto test_cell = [&](int c) {
+                for (int k = cell_start[c]; k < cell_end[c]; k++) { test_nbr(cell_agents[k]); }
+            };
+
+            if (!sp->use_cell_lists) {
+                for (int j = 0; j < n; j++) { test_nbr(j); }
+            }
+            else if (hashed_cells) {
+                for_each_hashed_cell_near(agent_pos, cutoff, [&](int c) { test_cell(c); return false; });
+            }
+            else {
+                // rows and columns of cells overlapping the square of side 2 * cutoff around the agent
+                int lo_x = floor((agent_pos.x - cutoff + cr) / cw);
+                int hi_x = floor((agent_pos.x + cutoff + cr) / cw);
+                int lo_y = floor((agent_pos.y - cutoff + cr) / cw);
+                int hi_y = floor((agent_pos.y + cutoff + cr) / cw);
+                bool past_edge = lo_x < 0 || lo_y < 0 || hi_x >= cps || hi_y >= cps;
+
+                if (sp->periodic) {
+                    // wrap around, visiting each row and column at most once
+                    if (hi_x - lo_x + 1 >= cps) { lo_x = 0; hi_x = cps - 1; }
+                    if (hi_y - lo_y + 1 >= cps) { lo_y = 0; hi_y = cps - 1; }
+                }
+                else {
+                    lo_x = std::max(lo_x, 0);
+                    lo_y = std::max(lo_y, 0);
+                    hi_x = std::min(hi_x, cps - 1);
+                    hi_y = std::min(hi_y, cps - 1);
+                }
+
+                for (int x = lo_x; x <= hi_x; x++) {
+                    for (int y = lo_y; y <= hi_y; y++) {
+                        test_cell(((x % cps + cps) % cps) * cps + (y % cps + cps) % cps);
+                    }
+                }
+
+                // agents outside the grid can only be near an agent whose search square reaches past its edge
+                // (in periodic worlds the overflow cell only holds agents sitting exactly on the boundary)
+                if (past_edge || sp->periodic) { test_cell(overflow_cell); }
+            }
 
-        edge.set_pos(Pose(gp->x + rng, gp->y, 0, 0)); // RIGHT
-        xmax = std::upper_bound(agents_byx_vec.begin(), agents_byx_vec.end(), &edge, ltx());
+            verlet_start[i + 1] = nbrs.size() - list_begin;
+        }
+    };
 
-        edge.set_pos(Pose(gp->x, gp->y - rng, 0, 0)); // BOTTOM
-        ymin = std::lower_bound(agents_byy_vec.begin(), agents_byy_vec.end(), &edge, lty());
+    if (num_blocks > 1) {
+        pool->parallel_for(num_blocks, [&](int begin, int end) { for (int b = begin; b < end; b++) { build_block(b); } });
+    }
+    else { build_block(0); }
+
+    // list lengths -> offsets, then concatenate the blocks' lists in agent order
+    for (int i = 0; i < n; i++) { verlet_start[i + 1] += verlet_start[i]; }
+    verlet_nbrs.clear();
+    verlet_nbrs.reserve(verlet_start[n]);
+    for (const std::vector<int> &nbrs : verlet_block_nbrs) {
+        verlet_nbrs.insert(verlet_nbrs.end(), nbrs.begin(), nbrs.end());
+    }
 
-        edge.set_pos(Pose(gp->x, gp->y + rng, 0, 0)); // TOP
-        ymax = std::upper_bound(agents_byy_vec.begin(), agents_byy_vec.end(), &edge, lty());
+    verlet_builds++;
+    verlet_total_length += verlet_nbrs.size();
+    verlet_avg_length = n > 0 ? (double)verlet_nbrs.size() / n : 0;
+}
 
-        // put these models into sets keyed on pointer
-        std::set<Agent *> horiz, vert;
+// Draw outlines of all cells in the grid
+void SimulationData::draw_cells() {
+    int cps = sp->cells_per_side;
+    float cw = sp->cell_width;
+
+    // every grid cell but the overflow cell
+    int num_drawn = hashed_cells ? num_cells : cps * cps;
+
+    for (int c = 0; c < num_drawn; c++) {
+        float xmin = cell_origin() + cell_idx(c) * cw;
+        float ymin = cell_origin() + cell_idy(c) * cw;
+
+        glBegin(GL_LINE_LOOP);               // Draw outline of cell, with no fill
+        glColor4f(0.0f, 0.9, 0.0f, 0.2);    // Green outline
+        glVertex2f(xmin, ymin);              // x, y
+        glVertex2f(xmin + cw, ymin);
+        glVertex2f(xmin + cw, ymin + cw);
+        glVertex2f(xmin, ymin + cw);
+        glEnd();
+    }
+}
 
-        for (; xmin != xmax; ++xmin)
-            horiz.insert(*xmin);
+// Find nearby agents to a given position
+std::vector<int> SimulationData::find_nearby_sorted_agents(const Pose2 &agent_pos) {
+    std::vector<int> nearby_sorted_agents;
 
-        for (; ymin != ymax; ++ymin)
-            vert.insert(*ymin);
+    // vecs_sorted(); // test whether the position vector is sorted
 
-        // the intersection of the sets is all the fiducials close by
-        std::set_intersection(horiz.begin(), horiz.end(), vert.begin(), vert.end(), std::inserter(nearby_sorted_agents, nearby_sorted_agents.end()));
+    if (sp->use_sorted_agents) {
+        for_each_nearby_sorted_agent(agent_pos, [&](int id) {
+            nearby_sorted_agents.push_back(id);
+            return false;
+        });
     }
 
     return nearby_sorted_agents;
 }
 
 // Use cell lists instead
-std::vector<Agent *> SimulationData::find_nearby_cell_lists(Pose *agent_pos) {
-    std::vector<Agent *> nearby;
+std::vector<int> SimulationData::find_nearby_cell_lists(const Pose2 &agent_pos) {
+    std::vector<int> nearby;
 
     if (sp->use_cell_lists) {
-        Cell *my_cell = get_cell_for_pos(agent_pos);
+        int my_cell = get_cell_for_pos(agent_pos.x, agent_pos.y);
 
-        // printf("neighbors to this cell: %zu \n", my_cell->neighbors.size());
-        
         // put agents in my_cell and its neighbors into nearby
-        nearby.insert(nearby.end(), my_cell->occupants.begin(), my_cell->occupants.end());
-        for (Cell *nbr : my_cell->neighbors) {
-            // printf("in cell lists inserting neighbors... \n");
-            nearby.insert(nearby.end(), nbr->occupants.begin(), nbr->occupants.end());
+        // (a missing hashed cell has no occupied neighbors, or it would have been created)
+        if (my_cell >= 0) {
+            for_each_nearby_cell(my_cell, [&](int c) {
+                nearby.insert(nearby.end(), cell_agents.begin() + cell_start[c], cell_agents.begin() + cell_end[c]);
+            });
         }
     }
 
@@ -248,28 +966,79 @@ std::vector<Agent *> SimulationData::find_nearby_cell_lists(Pose *agent_pos) {
 }
 
 
+// Or the k-d tree
+std::vector<int> SimulationData::find_nearby_kd_tree(const Pose2 &agent_pos) {
+    std::vector<int> nearby;
+
+    if (sp->use_kd_tree) {
+        meters_t span = sp->periodic ? 2 * sp->r_upper : 0;
+        kd_tree.for_each_leaf_near(agent_pos.x, agent_pos.y, sp->sensing_range + KD_ROUNDING_MARGIN, span, [&](const KdTree::Node &leaf) {
+            nearby.insert(nearby.end(), kd_tree.ids.begin() + leaf.begin, kd_tree.ids.begin() + leaf.end);
+            return false;
+        });
+    }
+
+    return nearby;
+}
+
+
+// Screen the leaves of the k-d tree near agent_pos against the cone query q in batches, calling f(ids, in_cone, batch)
+// for each; f returns true to stop early, and the return value says whether it did
+template <typename F>
+static bool for_each_kd_batch(const SimulationData &sd, const Pose2 &agent_pos, const cone_query &q, F f) {
+    const KdTree &kd = sd.kd_tree;
+    const sim_params *sp = sd.sp;
+    meters_t span = sp->periodic ? 2 * sp->r_upper : 0;
+    unsigned char in_cone[SENSE_BATCH_SIZE];
+
+    return kd.for_each_leaf_near(agent_pos.x, agent_pos.y, sp->sensing_range + KD_ROUNDING_MARGIN, span, [&](const KdTree::Node &leaf) {
+        for (int k = leaf.begin; k < leaf.end; k += SENSE_BATCH_SIZE) {
+            int batch = std::min(SENSE_BATCH_SIZE, leaf.end - k);
+            vision_cone_batch(q, &kd.px[k], &kd.py[k], batch, in_cone);
+            if (f(&kd.ids[k], in_cone, batch)) { return true; }
+        }
+        return false;
+    });
+}
+
+
+// Screen the Verlet list of agent agent_id against the cone query q in batches, calling f(ids, in_cone, batch) for each
+// f returns true to stop early; the return value says whether it did
+template <typename F>
+static bool for_each_verlet_batch(const SimulationData &sd, int agent_id, const cone_query &q, F f) {
+    real_t xs[SENSE_BATCH_SIZE], ys[SENSE_BATCH_SIZE];
+    unsigned char in_cone[SENSE_BATCH_SIZE];
+    int end = sd.verlet_start[agent_id + 1];
+
+    for (int k = sd.verlet_start[agent_id]; k < end; k += SENSE_BATCH_SIZE) {
+        int batch = std::min(SENSE_BATCH_SIZE, end - k);
+        const int *ids = &sd.verlet_nbrs[k];
+        for (int j = 0; j < batch; j++) {
+            xs[j] = sd.state.x[ids[j]];
+            ys[j] = sd.state.y[ids[j]];
+        }
+
+        vision_cone_batch(q, xs, ys, batch, in_cone);
+        if (f(ids, in_cone, batch)) { return true; }
+    }
+
+    return false;
+}
+
+
 // Return who an agent with id agent_id and Pose agent_pos would sense in its cone-shaped field of view
-std::vector <sensor_result> SimulationData::sense(int agent_id, Pose agent_pos) {
+std::vector <sensor_result> SimulationData::sense(int agent_id, Pose2 agent_pos) {
     // check that sensing functions agree
     // neighbor_functions_agree(agent_id, agent_pos);
 
     std::vector <sensor_result> result;
 
-    // find nearby neighbors with vectors
-    // first, find a smaller collection of nearby neighbors
-    std::vector<Agent *> nearby = sp->use_cell_lists ? find_nearby_cell_lists(&agent_pos) : find_nearby_sorted_agents(&agent_pos);
-    // printf("Neighbors nearby: %zu \n", nearby.size());
-
-    // now test more carefully for whether these neighbors are in agent's FOV
-    for (Agent *nbr : nearby) {
-        // printf("Agent %i has agent %i nearby... \n", agent_id, nbr->id);
-
-        Pose nbr_pos = nbr->get_pos();
+    // test carefully whether a nearby neighbor is in agent's FOV
+    auto test_nbr = [&](int nbr_id) {
+        Pose2 nbr_pos(state.x[nbr_id], state.y[nbr_id], 0);
         // if periodic world, test if the nearest periodic coordinate is in FOV
         if (sp->periodic) { nbr_pos = nearest_periodic(agent_pos, nbr_pos, sp->r_upper); }
 
-        int nbr_id = nbr->id;
-
         cone_result cr = in_vision_cone(agent_pos, nbr_pos, sp->sensing_range, sp->sensing_angle);
         if (cr.in_cone && agent_id != nbr_id) {
             sensor_result new_result;
@@ -278,12 +1047,120 @@ std::vector <sensor_result> SimulationData::sense(int agent_id, Pose agent_pos)
             result.push_back(new_result);
             // printf("someone in vision cone for agent: %i\n", agent_id);
         }
+    };
+
+    // first, find a smaller collection of nearby neighbors
+    if (sp->use_verlet_lists) {
+        cone_query q = make_cone_query(agent_pos, sp->sensing_range, sp->sensing_angle, sp->periodic, sp->r_upper);
+        for_each_verlet_batch(*this, agent_id, q, [&](const int *ids, const unsigned char *in_cone, int batch) {
+            for (int j = 0; j < batch; j++) {
+                if (in_cone[j]) { test_nbr(ids[j]); }
+            }
+            return false;
+        });
+    }
+    else if (sp->use_kd_tree) {
+        cone_query q = make_cone_query(agent_pos, sp->sensing_range, sp->sensing_angle, sp->periodic, sp->r_upper);
+        for_each_kd_batch(*this, agent_pos, q, [&](const int *ids, const unsigned char *in_cone, int batch) {
+            for (int j = 0; j < batch; j++) {
+                if (in_cone[j]) { test_nbr(ids[j]); }
+            }
+            return false;
+        });
+    }
+    else if (sp->use_cell_lists) {
+        // screen the occupants of the nearby cells in batches, then test the few hits carefully for their distances
+        cone_query q = make_cone_query(agent_pos, sp->sensing_range, sp->sensing_angle, sp->periodic, sp->r_upper);
+        unsigned char in_cone[SENSE_BATCH_SIZE];
+
+        for_each_candidate_cell(agent_id, agent_pos, [&](int c) {
+            for (int k = cell_start[c]; k < cell_end[c]; k += SENSE_BATCH_SIZE) {
+                int batch = std::min(SENSE_BATCH_SIZE, cell_end[c] - k);
+                vision_cone_batch(q, &cell_x[k], &cell_y[k], batch, in_cone);
+                for (int j = 0; j < batch; j++) {
+                    if (in_cone[j]) { test_nbr(cell_agents[k + j]); }
+                }
+            }
+            return false;
+        });
+    }
+    else {
+        for_each_nearby_sorted_agent(agent_pos, [&](int nbr_id) {
+            test_nbr(nbr_id);
+            return false;
+        });
     }
 
     return result;
 }
 
 
+// Every neighbor that can be in the vision cone is in one of the cells searched from the agent's pose, so if the pose
+// is the same and no agent in those cells has moved, sensing again would give the same result
+bool SimulationData::sense_unchanged(int agent_id, const Pose2 &agent_pos) const {
+    if (!sp->event_driven_sensing || !sp->use_cell_lists || record_sensed) { return false; }
+
+    const Pose2 &from = sensed_from[agent_id];
+    if (from.x != agent_pos.x || from.y != agent_pos.y || from.a != agent_pos.a) { return false; }
+
+    return !for_each_candidate_cell(agent_id, agent_pos, [this](int c) { return cell_changed[c] != 0; });
+}
+
+
+// Return whether an agent with id agent_id and Pose agent_pos would sense anyone in its cone-shaped field of view
+// Same test as sense(), but the cells ahead of the agent are checked first and the search ends at the first hit
+bool SimulationData::sense_any(int agent_id, Pose2 agent_pos) {
+    auto nbr_in_cone = [&](int nbr_id) {
+        if (nbr_id == agent_id) { return false; }
+
+        Pose2 nbr_pos(state.x[nbr_id], state.y[nbr_id], 0);
+        // if periodic world, test if the nearest periodic coordinate is in FOV
+        if (sp->periodic) { nbr_pos = nearest_periodic(agent_pos, nbr_pos, sp->r_upper); }
+
+        return in_vision_cone(agent_pos, nbr_pos, sp->sensing_range, sp->sensing_angle).in_cone;
+    };
+
+    if (sp->use_verlet_lists) {
+        cone_query q = make_cone_query(agent_pos, sp->sensing_range, sp->sensing_angle, sp->periodic, sp->r_upper);
+        // an agent's Verlet list never holds the agent itself, so any neighbor in the cone will do
+        return for_each_verlet_batch(*this, agent_id, q, [&](const int *, const unsigned char *in_cone, int batch) {
+            for (int j = 0; j < batch; j++) {
+                if (in_cone[j]) { return true; }
+            }
+            return false;
+        });
+    }
+
+    if (sp->use_kd_tree) {
+        cone_query q = make_cone_query(agent_pos, sp->sensing_range, sp->sensing_angle, sp->periodic, sp->r_upper);
+        return for_each_kd_batch(*this, agent_pos, q, [&](const int *ids, const unsigned char *in_cone, int batch) {
+            for (int j = 0; j < batch; j++) {
+                if (in_cone[j] && ids[j] != agent_id) { return true; }
+            }
+            return false;
+        });
+    }
+
+    if (sp->use_cell_lists) {
+        cone_query q = make_cone_query(agent_pos, sp->sensing_range, sp->sensing_angle, sp->periodic, sp->r_upper);
+        unsigned char in_cone[SENSE_BATCH_SIZE];
+
+        return for_each_candidate_cell(agent_id, agent_pos, [&](int c) {
+            for (int k = cell_start[c]; k < cell_end[c]; k += SENSE_BATCH_SIZE) {
+                int batch = std::min(SENSE_BATCH_SIZE, cell_end[c] - k);
+                vision_cone_batch(q, &cell_x[k], &cell_y[k], batch, in_cone);
+                for (int j = 0; j < batch; j++) {
+                    if (in_cone[j] && cell_agents[k + j] != agent_id) { return true; }
+                }
+            }
+            return false;
+        });
+    }
+
+    return for_each_nearby_sorted_agent(agent_pos, nbr_in_cone);
+}
+
+
 
 
 
@@ -297,31 +1174,20 @@ bool SimulationData::vecs_sorted() {
     const char* redText = "\033[1;31m";
     const char* resetText = "\033[0m";
 
-    Agent *begin_agent = *agents_byx_vec.begin();
-    double last_x = begin_agent->get_pos().x;
-    for (Agent *a : agents_byx_vec) {
-        if(!(last_x <= a->get_pos().x)) {
+    double last_x = state.x[agents_byx_vec.front()];
+    for (int i : agents_byx_vec) {
+        if(!(last_x <= state.x[i])) {
             printf("%sx-positions not sorted in vec!%s\n", redText, resetText);
             sorted = false;
         }
-        last_x = a->get_pos().x;
-    }
-
-    begin_agent = *agents_byy_vec.begin();
-    double last_y = begin_agent->get_pos().y;
-    for (Agent *a : agents_byx_vec) {
-        if(!(last_y <= a->get_pos().y)) {
-            printf("%sy-positions not sorted in vec!%s\n", redText, resetText);
-            sorted = false;
-        }
-        last_x = a->get_pos().y;
+        last_x = state.x[i];
     }
 
     return sorted;
 }
 
 // check that the two neighbor-finding implementations agree (find the same number of neighbors in cone)
-bool SimulationData::neighbor_functions_agree(int agent_id, Pose agent_pos) {
+bool SimulationData::neighbor_functions_agree(int agent_id, Pose2 agent_pos) {
     if (!sp->use_cell_lists || ! sp->use_sorted_agents) {
         printf("To check if the two sensing implementations agree, use_cell_lists and use_sorted_agents both need to be true. \n");
         return false;
@@ -329,29 +1195,29 @@ bool SimulationData::neighbor_functions_agree(int agent_id, Pose agent_pos) {
 
     bool agree = true; 
 
-    std::vector<Agent *> nearby_sa = find_nearby_sorted_agents(&agent_pos);
-    std::vector<Agent *> nearby_cl = find_nearby_cell_lists(&agent_pos);
+    std::vector<int> nearby_sa = find_nearby_sorted_agents(agent_pos);
+    std::vector<int> nearby_cl = find_nearby_cell_lists(agent_pos);
 
-    std::vector<Agent *> seen_sa;
-    std::vector<Agent *> seen_cl;
+    std::vector<int> seen_sa;
+    std::vector<int> seen_cl;
 
-    for (Agent *nbr : nearby_sa) { 
-        Pose nbr_pos = nbr->get_pos();
+    for (int nbr : nearby_sa) { 
+        Pose2 nbr_pos = state.get_pos(nbr);
         if (sp->periodic) { nbr_pos = nearest_periodic(agent_pos, nbr_pos, sp->r_upper); }
 
         cone_result cr = in_vision_cone(agent_pos, nbr_pos, sp->sensing_range, sp->sensing_angle);
-        if (cr.in_cone && agent_id != nbr->id) {
+        if (cr.in_cone && agent_id != nbr) {
             seen_sa.push_back(nbr);
         }
     }
 
 
-    for (Agent *nbr : nearby_cl) { 
-        Pose nbr_pos = nbr->get_pos();
+    for (int nbr : nearby_cl) { 
+        Pose2 nbr_pos = state.get_pos(nbr);
         if (sp->periodic) { nbr_pos = nearest_periodic(agent_pos, nbr_pos, sp->r_upper); }
 
         cone_result cr = in_vision_cone(agent_pos, nbr_pos, sp->sensing_range, sp->sensing_angle);
-        if (cr.in_cone && agent_id != nbr->id) {
+        if (cr.in_cone && agent_id != nbr) {
             seen_cl.push_back(nbr);
         }
     }
@@ -360,6 +1226,22 @@ bool SimulationData::neighbor_functions_agree(int agent_id, Pose agent_pos) {
         printf("Different number of agents sensed using sorted positions vs. cell lists! \n");
         agree = false;
     }
+
+    if (sp->use_kd_tree) {
+        int seen_kd = 0;
+        for (int nbr : find_nearby_kd_tree(agent_pos)) {
+            Pose2 nbr_pos = state.get_pos(nbr);
+            if (sp->periodic) { nbr_pos = nearest_periodic(agent_pos, nbr_pos, sp->r_upper); }
+
+            cone_result cr = in_vision_cone(agent_pos, nbr_pos, sp->sensing_range, sp->sensing_angle);
+            if (cr.in_cone && agent_id != nbr) { seen_kd++; }
+        }
+
+        if (seen_kd != (int)seen_sa.size()) {
+            printf("Different number of agents sensed using sorted positions vs. the k-d tree! \n");
+            agree = false;
+        }
+    }
     // else {
     //     printf("Sensing methods match. \n");
     // }
@@ -1,7 +1,20 @@
+#include <filesystem>
 #include "simulation_manager.hh"
 
 // Constructor
-SimulationManager::SimulationManager(sim_params sim_params) {
+SimulationManager::SimulationManager(sim_params sim_params) : sd(nullptr), engine(nullptr), pool(nullptr) {
+    reconfigure(sim_params);
+}
+
+// Destructor
+SimulationManager::~SimulationManager(){
+    delete pool;
+    delete engine;
+    delete sd;
+}
+
+
+void SimulationManager::reconfigure(sim_params sim_params) {
     sp = sim_params;
 
     // Warnings about incompatible parameter settings
@@ -12,55 +25,294 @@ SimulationManager::SimulationManager(sim_params sim_params) {
         }
     }
 
+    if (sp.event_driven_sensing & !sp.use_cell_lists) {
+        sp.event_driven_sensing = false;
+        if (sp.verbose) {
+            printf("Warning: event driven sensing needs cell lists, so it has been turned off.\n");
+        }
+    }
+
+    if (sp.domain_decomposition & !(sp.periodic & sp.use_cell_lists & (sp.num_threads > 1))) {
+        sp.domain_decomposition = false;
+        if (sp.verbose) {
+            printf("Warning: domain decomposition needs a periodic world, cell lists and more than one thread, so it has been turned off.\n");
+        }
+    }
+
+    if (sp.domain_decomposition & (sp.use_sorted_agents | sp.use_kd_tree | sp.use_verlet_lists)) {
+        sp.use_sorted_agents = false;
+        sp.use_kd_tree = false;
+        sp.use_verlet_lists = false;
+        if (sp.verbose) {
+            printf("Warning: domain decomposition only keeps the cell lists up to date as agents migrate, so sorted agents, the k-d tree and Verlet lists have been turned off.\n");
+        }
+    }
+
+    // Master seed for the agents' random streams
+    if (sp.seed == 0) { sp.seed = Random::generate_seed(); }
+    if (sp.verbose) { printf("Master seed: %llu \n", (unsigned long long)sp.seed); }
+
     // Derived parameters
     sp.cells_per_side = floor(2.0 * sp.cells_range / sp.sensing_range);
     sp.cell_width = 2.0 * sp.cells_range / sp.cells_per_side;
-
-    // Initialize Simulation Data
-    sd = new SimulationData(&sp);
-
-    // Create agents vector and pass copies to SimulationData
-    for (int i = 0; i < sp.num_agents; i++) {
-        agents.push_back(new NoiseAgent(i, &sp, sd));
+    if (sp.hashed_cell_lists && !sp.periodic) { sp.cell_width = sp.sensing_range; } // hashed cells are not fitted to cells_range
+
+    // Initialize Simulation Data (or resize the last world's)
+    if (sd) { sd->reconfigure(); }
+    else { sd = new SimulationData(&sp); }
+
+    // Take the agents from the arena: agents kept from the last world are set up again, in id order along with
+    // the new ones, so they draw what new agents would
+    agent_arena.reserve(sp.num_agents);
+    while ((int)agent_arena.size() > sp.num_agents) { agent_arena.pop_back(); }
+    for (NoiseAgent &a : agent_arena) { a.init(); }
+    for (int i = agent_arena.size(); i < sp.num_agents; i++) {
+        agent_arena.emplace_back(i, &sp, sd);
     }
 
+    // Pass pointers to SimulationData
+    agents.clear();
+    for (NoiseAgent &a : agent_arena) { agents.push_back(&a); }
     sd->agents = agents;
 
-    if (sp.use_sorted_agents) {
-        sd->agents_byx_vec = agents;
-        sd->agents_byy_vec = agents;
+    delete engine;
+    engine = make_agent_engine<RandomGoals, ConditionalNoise>(sd); // NoiseAgent's step, specialised on the run's flags
+
+    // Worker threads for stepping agents in parallel, kept while the thread count stays the same
+    if (pool && pool->num_threads != sp.num_threads) {
+        delete pool;
+        pool = nullptr;
     }
+    if (!pool && sp.num_threads > 1) { pool = new WorkerPool(sp.num_threads); }
+    sd->pool = pool;
 
     sd->reset();
 
-}
-
-// Destructor
-SimulationManager::~SimulationManager(){
-    delete sd;
-    for (Agent *a : agents) { delete a; }
+    // Equilibrated states to start trials from
+    burn_in_saved = 0;
+    snapshots.clear();
+    next_snapshot = 0;
+    if (!sp.snapshot_dir.empty() && load_snapshots() == 0 && sp.verbose) {
+        printf("Warning: no snapshots in %s yet, so trials start from random poses.\n", snapshot_file().c_str());
+    }
 }
 
 
 void SimulationManager::update() {
+    if (pool) { 
+        update_parallel(); 
+        return;
+    }
+
     // save data here before any updates occur
 
     // update simtime and the sorted agent info in simulationdata
     sd->update();
 
+    // full sensor lists are only needed if the state after this step will be saved
+    sd->record_sensed = save_due();
+
     // update all agent sensors
-    for (Agent *a : agents) { a->sensing_update(); }
+    engine->sensing_update(0, sp.num_agents);
 
     // update all agent positions
     // working with the assumption that they should not collide in this one step due to sufficient stop conditions
-    for (Agent *a : agents) { a->position_update(); }
+    engine->position_update(0, sp.num_agents);
+    update_trails();
+}
+
+
+// Same step as update(), with the sensing and moving loops split across the worker pool
+// Produces the same result as the serial loops for a given seed:
+// positions do not change until every agent has sensed and decided, and each agent draws from its own random stream
+// With domain decomposition, each thread steps the agents of its own domain
+void SimulationManager::update_parallel() {
+    sd->update();
+    sd->record_sensed = save_due();
+
+    if (sp.domain_decomposition) {
+        const std::vector<int> &first = sd->domain_first;
+        pool->parallel_for(sd->num_domains, [&](int begin, int end) {
+            for (int d = begin; d < end; d++) { engine->sensing_update(first[d], first[d + 1]); }
+        });
+        pool->parallel_for(sd->num_domains, [&](int begin, int end) {
+            for (int d = begin; d < end; d++) { engine->position_update(first[d], first[d + 1]); }
+        });
+        update_trails();
+        return;
+    }
+
+    // sense against the current (frozen) positions, then check goals and choose new speeds
+    // (decisions only touch an agent's own state, so they can run alongside other agents' sensing)
+    pool->parallel_for(sp.num_agents, [this](int begin, int end) { engine->sensing_update(begin, end); });
+
+    // barrier: parallel_for only returns once every agent has sensed, so it is safe to move
+    pool->parallel_for(sp.num_agents, [this](int begin, int end) { engine->position_update(begin, end); });
+    update_trails();
+}
+
+
+// save current positions as footprints for the GUI
+void SimulationManager::update_trails() {
+    if (sp.gui_draw_footprints & sd->footprint_interval.due(sd->step)) {
+        for (Agent *a : agents) { a->update_trail(); }
+    }
 }
 
 
 void SimulationManager::reset() {
     sd->sim_time = 0; // needs to happen first since agents store this time as goal_birth_time
-    for (Agent *a : agents) { a->reset(); }
+    sd->step = 0; // and key their random streams by the step
+    sd->end_step = 0;
+    engine->reset(0, sp.num_agents);
+    double start_time = snapshots.empty() ? 0 : start_from_snapshot();
+    for (Agent *a : agents) { a->trail.clear(); }
     sd->reset(); // new randomized poses are out of order... sort them again!
+
+    // warm starts carry on the clock from the end of the burn-in, so their saved rows line up with cold trials'
+    if (start_time > 0) {
+        sd->step = steps_to_reach(start_time, sp.dt);
+        sd->sim_time = sd->step * (double)sp.dt;
+    }
+}
+
+
+double SimulationManager::start_from_snapshot() {
+    // a stream of its own, keyed by an id past the last agent's
+    Random::Stream pick(sp.seed, sd->trial, sp.num_agents, 0);
+    const world_snapshot &snap = snapshots[pick.get_unif_int(0, snapshots.size() - 1)];
+
+    AgentStore &s = sd->state;
+    for (int id = 0; id < sp.num_agents; id++) {
+        int k = sd->agent_store_slot[id];
+        s.x[k] = snap.x[id];
+        s.y[k] = snap.y[id];
+        s.a[k] = snap.a[id];
+        s.goal_x[k] = snap.goal_x[id];
+        s.goal_y[k] = snap.goal_y[id];
+        s.travel_angle[k] = snap.travel_angle[id];
+        s.phase_count[k] = snap.phase_count[id];
+        s.runsteps[k] = snap.runsteps[id];
+        s.goal_birth_time[k] = snap.burn_in; // goals count from the start of the trial, as after a cold reset
+    }
+    burn_in_saved += snap.burn_in;
+    return snap.burn_in;
+}
+
+
+std::string SimulationManager::snapshot_file() const {
+    // every parameter of the dynamics is in the name: a snapshot is only an equilibrated state of the world it came from
+    // (dt among them, since phase counts and run lengths are counted in steps)
+    char name[512];
+    snprintf(name, sizeof(name), "snapshots_periodic%i_circle%i_r%g_rl%g_robots%i_dt%g_speed%g_range%g_angle%g_tol%g_"
+             "turn%g_noise%g_bias%g_runsteps%i_rand%i_prob%g_cond%i.txt", (int)sp.periodic, (int)sp.circle_arena, sp.r_upper,
+             sp.r_lower, sp.num_agents, sp.dt, sp.cruisespeed, sp.sensing_range, sp.sensing_angle, sp.goal_tolerance,
+             sp.turnspeed, sp.anglenoise, sp.anglebias, sp.avg_runsteps, (int)sp.randomize_runsteps, sp.noise_prob,
+             (int)sp.conditional_noise);
+    return (std::filesystem::path(sp.snapshot_dir) / name).string();
+}
+
+
+void SimulationManager::save_snapshots(int count, double burn_in) {
+    std::string file_name = snapshot_file();
+    bool new_file = !std::filesystem::exists(file_name);
+    std::filesystem::create_directories(sp.snapshot_dir);
+    std::ofstream file(file_name, std::ios_base::app);
+    if (new_file) {
+        file << "snapshot,burn_in,robot_id,x_pos,y_pos,angle,goal_x_pos,goal_y_pos,travel_angle,phase_count,runsteps\n";
+    }
+    file << std::setprecision(17); // enough digits to read back the exact state
+
+    // burn in from random poses, on trial keys of their own (counting down from -1), so trials started from the
+    // snapshots never replay a burn-in's random numbers
+    std::vector<world_snapshot> library;
+    library.swap(snapshots);
+    uint64_t end_step = steps_to_reach(burn_in, sp.dt);
+    for (int i = 0; i < count; i++) {
+        int index = next_snapshot++;
+        sd->trial = -1 - index;
+        reset();
+        while (sd->step < end_step) { update(); }
+
+        const AgentStore &s = sd->state;
+        world_snapshot snap;
+        snap.burn_in = sd->sim_time;
+        for (int id = 0; id < sp.num_agents; id++) {
+            int k = sd->agent_store_slot[id];
+            snap.x.push_back(s.x[k]);
+            snap.y.push_back(s.y[k]);
+            snap.a.push_back(s.a[k]);
+            snap.goal_x.push_back(s.goal_x[k]);
+            snap.goal_y.push_back(s.goal_y[k]);
+            snap.travel_angle.push_back(s.travel_angle[k]);
+            snap.phase_count.push_back(s.phase_count[k]);
+            snap.runsteps.push_back(s.runsteps[k]);
+            file << index << "," << snap.burn_in << "," << id << "," << (double)s.x[k] << "," << (double)s.y[k] << ","
+                 << (double)s.a[k] << "," << (double)s.goal_x[k] << "," << (double)s.goal_y[k] << ","
+                 << (double)s.travel_angle[k] << "," << s.phase_count[k] << "," << s.runsteps[k] << "\n";
+        }
+        library.push_back(snap);
+    }
+    snapshots.swap(library);
+
+    if (sp.verbose) {
+        printf("Saved %i snapshots after %.0f s of burn-in to %s (%i in total)\n", count, burn_in, file_name.c_str(), (int)snapshots.size());
+    }
+}
+
+
+int SimulationManager::load_snapshots() {
+    snapshots.clear();
+    next_snapshot = 0;
+    std::ifstream file(snapshot_file());
+    if (!file) { return 0; }
+
+    std::vector<int> rows; // agent rows read for each snapshot
+    std::string line;
+    std::getline(file, line); // header
+    while (std::getline(file, line)) {
+        int index, id, phase_count, runsteps;
+        double burn_in, x, y, a, goal_x, goal_y, travel_angle;
+        if (sscanf(line.c_str(), "%d,%lf,%d,%lf,%lf,%lf,%lf,%lf,%lf,%d,%d", &index, &burn_in, &id, &x, &y, &a, &goal_x, &goal_y,
+                   &travel_angle, &phase_count, &runsteps) != 11) { continue; }
+        if (index < 0 || id < 0 || id >= sp.num_agents) { continue; }
+
+        if (index >= (int)snapshots.size()) {
+            snapshots.resize(index + 1);
+            rows.resize(index + 1, 0);
+        }
+        world_snapshot &snap = snapshots[index];
+        if (snap.x.empty()) {
+            snap.x.assign(sp.num_agents, 0);
+            snap.y = snap.a = snap.goal_x = snap.goal_y = snap.travel_angle = snap.x;
+            snap.phase_count.assign(sp.num_agents, 0);
+            snap.runsteps = snap.phase_count;
+        }
+        snap.burn_in = burn_in;
+        snap.x[id] = x;
+        snap.y[id] = y;
+        snap.a[id] = a;
+        snap.goal_x[id] = goal_x;
+        snap.goal_y[id] = goal_y;
+        snap.travel_angle[id] = travel_angle;
+        snap.phase_count[id] = phase_count;
+        snap.runsteps[id] = runsteps;
+        rows[index]++;
+    }
+
+    // drop snapshots cut short (e.g. by a run stopped while saving), but keep their indices taken
+    next_snapshot = snapshots.size();
+    int kept = 0;
+    for (size_t i = 0; i < snapshots.size(); i++) {
+        if (rows[i] != sp.num_agents) { continue; }
+        if (kept != (int)i) { snapshots[kept] = std::move(snapshots[i]); }
+        kept++;
+    }
+    if (kept < (int)snapshots.size() && sp.verbose) {
+        printf("Warning: %i incomplete snapshots in %s have been skipped.\n", (int)snapshots.size() - kept, snapshot_file().c_str());
+    }
+    snapshots.resize(kept);
+    return kept;
 }
 
 
@@ -72,20 +324,30 @@ void SimulationManager::run_trials(int trials, double trial_length) {
         outfile.open(sp.outfile_name, std::ios_base::app);
     }
 
+    double saved_before = burn_in_saved;
     for (int i = 0; i < trials; i++) {
         run_trial(trial_length, i);
     }
 
+    if (sp.verbose && burn_in_saved > saved_before) {
+        double saved = burn_in_saved - saved_before;
+        printf("Starting from snapshots skipped %.0f s of burn-in (%.0f s per trial) \n", saved, saved / trials);
+    }
+
     // close outfile
     if (!sp.outfile_name.empty()) { outfile.close(); }
     
 }
 
 void SimulationManager::run_trial(double trial_length, int trial_id) {
+    sd->trial = trial_id;
     reset();
-    while (sd->sim_time < trial_length) {
+    uint64_t start_step = sd->step; // past the burn-in for warm starts
+    uint64_t end_step = start_step + steps_to_reach(trial_length, sp.dt);
+    sd->end_step = end_step;
+    while (sd->step < end_step) {
 
-        if (!sp.outfile_name.empty() && fmod(sd->sim_time, sp.save_data_interval) < 0.001) {
+        if (save_due()) {
             save_data(trial_id);
         }
 
@@ -93,62 +355,106 @@ void SimulationManager::run_trial(double trial_length, int trial_id) {
     }
 
     if (!sp.outfile_name.empty()) { save_data(trial_id); }
+
+    if (sp.verbose && sp.use_cell_lists && sp.incremental_cell_lists) {
+        double steps = sd->step - start_step;
+        printf("Trial %i: %llu cell migrations (%.2f per step), %llu cell list rebuilds \n", trial_id, 
+            (unsigned long long)sd->total_cell_migrations, sd->total_cell_migrations / steps, 
+            (unsigned long long)sd->cell_rebuilds);
+    }
+
+    if (sp.verbose && sp.domain_decomposition) {
+        printf("Trial %i: %i domains, %llu agents migrated between them (%.2f per step) \n", trial_id, sd->num_domains,
+            (unsigned long long)sd->domain_migrations, sd->domain_migrations / (double)(sd->step - start_step));
+    }
+
+    if (sp.verbose && sp.use_cell_lists && sd->hashed_cells) {
+        printf("Trial %i: %i hashed cells, laid out %llu times \n", trial_id, sd->num_cells, (unsigned long long)sd->cell_rehashes);
+    }
+
+    if (sp.verbose && sp.event_driven_sensing) {
+        double evaluations = (double)(sd->step - start_step) * sp.num_agents;
+        printf("Trial %i: %llu of %.0f sensing evaluations skipped (%.1f%%) \n", trial_id, 
+            (unsigned long long)sd->skipped_senses, evaluations, 100.0 * sd->skipped_senses / evaluations);
+    }
+
+    if (sp.verbose && sp.use_verlet_lists) {
+        double steps = sd->step - start_step;
+        printf("Trial %i: %llu Verlet list builds (one per %.2f steps), %.2f neighbors per list on average \n", trial_id, 
+            (unsigned long long)sd->verlet_builds, steps / sd->verlet_builds, 
+            (double)sd->verlet_total_length / sd->verlet_builds / sp.num_agents);
+    }
 }
 
 
 
 
+// The final state of a trial is saved even when the trial length is not a multiple of the save interval
+bool SimulationManager::save_due() {
+    return !sp.outfile_name.empty() && (sd->save_interval.due(sd->step) || (sd->end_step > 0 && sd->step == sd->end_step));
+}
+
+
 void SimulationManager::save_data(int trial_id) {
-    for (Agent *aa : agents) {
-        GoalAgent *a = (GoalAgent *)aa; // cast to GoalAgent
-        if (!a->stop) {
+    save_agent_rows(outfile, sp, trial_id, sd->sim_time, sd->state, 0, sd->agent_store_slot.data(), sd->slot_agent.data());
+}
+
+
+// Write one row per free agent, and one row per sensed neighbor for each stopped agent
+void save_agent_rows(std::ofstream &outfile, const sim_params &sp, int trial_id, double sim_time, const AgentStore &s, int first,
+                     const int *store_slot, const int *slot_agent) {
+    for (int id = 0; id < sp.num_agents; id++) {
+        int k = first + (store_slot ? store_slot[id] : id);
+        if (!s.stop[k]) {
             outfile << std::to_string(trial_id) + std::string(",") +
                 std::to_string(sp.periodic) + std::string(",") +
                 std::to_string(sp.num_agents) + std::string(",")
                 << sp.anglenoise << std::string(",")
                 << sp.noise_prob << std::string(",")
-                << sd->sim_time << std::string(",") +
-                std::to_string(a->id) + std::string(",")
-                << a->get_pos().x << std::string(",")
-                << a->get_pos().y << std::string(",")
-                << a->get_pos().a << std::string(",") 
-                << a->goal_pos.x << std::string(",")
-                << a->goal_pos.y << std::string(",") +
-                std::to_string(a->goal_birth_time) + std::string(",") +
-                std::to_string(a->goals_reached) + std::string(",") +
-                std::to_string(a->stop) + std::string(",") +
+                << sim_time << std::string(",") +
+                std::to_string(id) + std::string(",")
+                << s.x[k] << std::string(",")
+                << s.y[k] << std::string(",")
+                << s.a[k] << std::string(",") 
+                << s.goal_x[k] << std::string(",")
+                << s.goal_y[k] << std::string(",") +
+                std::to_string(s.goal_birth_time[k]) + std::string(",") +
+                std::to_string(s.goals_reached[k]) + std::string(",") +
+                std::to_string(s.stop[k]) + std::string(",") +
                 std::to_string(-1) + std::string(",") +
-                sp.addtl_data + std::string(",")
+                sp.addtl_data + std::string(",") +
+                std::to_string(sp.seed) + std::string(",")
                 << std::endl;
         }
 
         else {
-            if (a->sensed.size() == 0) {
+            if (s.sensed[k].size() == 0) {
                 printf("Error: Robot stopped but nothing in fiducials.... \n");
-                printf("Sim time: %f, Robot ID: %i \n", sd->sim_time, a->id);
+                printf("Sim time: %f, Robot ID: %i \n", sim_time, id);
             }
 
-            for (sensor_result other : a->sensed) {
+            for (sensor_result other : s.sensed[k]) {
                     outfile << std::to_string(trial_id) + std::string(",") +
                         std::to_string(sp.periodic) + std::string(",") +
                         std::to_string(sp.num_agents) + std::string(",")
                         << sp.anglenoise << std::string(",")
                         << sp.noise_prob << std::string(",")
-                        << sd->sim_time << std::string(",") +
-                        std::to_string(a->id) + std::string(",")
-                        << a->get_pos().x << std::string(",")
-                        << a->get_pos().y << std::string(",")
-                        << a->get_pos().a << std::string(",")
-                        << a->goal_pos.x << std::string(",")
-                        << a->goal_pos.y << std::string(",") +
-                        std::to_string(a->goal_birth_time) + std::string(",") +
-                        std::to_string(a->goals_reached) + std::string(",") +
-                        std::to_string(a->stop) + std::string(",") +
-                        std::to_string(other.id) + std::string(",") +
-                        sp.addtl_data + std::string(",")
+                        << sim_time << std::string(",") +
+                        std::to_string(id) + std::string(",")
+                        << s.x[k] << std::string(",")
+                        << s.y[k] << std::string(",")
+                        << s.a[k] << std::string(",")
+                        << s.goal_x[k] << std::string(",")
+                        << s.goal_y[k] << std::string(",") +
+                        std::to_string(s.goal_birth_time[k]) + std::string(",") +
+                        std::to_string(s.goals_reached[k]) + std::string(",") +
+                        std::to_string(s.stop[k]) + std::string(",") +
+                        std::to_string(slot_agent ? slot_agent[other.id] : other.id) + std::string(",") +
+                        sp.addtl_data + std::string(",") +
+                        std::to_string(sp.seed) + std::string(",")
                         << std::endl;
 
             }
         }
     }
-}
\ No newline at end of file
+}
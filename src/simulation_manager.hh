@@ -14,6 +14,15 @@
 #include "../random.hh"
 #include "agents.hh"
 #include "utils.hh"
+#include "worker_pool.hh"
+
+
+// The state of every agent at the end of a burn-in from random poses, to start trials from
+struct world_snapshot {
+    double burn_in; // simulated seconds run before the snapshot was taken
+    std::vector<real_t> x, y, a, goal_x, goal_y, travel_angle; // by agent id
+    std::vector<int> phase_count, runsteps;
+};
 
 
 // A simulation instance
@@ -24,18 +33,63 @@ class SimulationManager {
     // Destructor
     ~SimulationManager();
 
+    // Switch to new parameters (the next world of a sweep), leaving the simulation as SimulationManager(sim_params)
+    // would, but reusing this instance's agents, agent store, cells and worker threads instead of allocating new ones
+    void reconfigure(sim_params sim_params);
+
     sim_params sp;
     SimulationData *sd;
     /** Pointers to all the agents in this world. */
     std::vector <Agent *> agents;
+
+    /** Storage for the agents, kept across reconfigure() (agents point into it) */
+    std::vector <NoiseAgent> agent_arena;
+
+    /** Steps all the agents, with the goal and noise models and the boundary and turning flags fixed at compile time */
+    AgentEngineBase *engine;
     std::ofstream outfile;
 
+    /** Worker threads for the parallel step, or nullptr when sp.num_threads <= 1 */
+    WorkerPool *pool;
+
+    /** This world's equilibrated states from sp.snapshot_dir: if there are any, reset() starts from one of them */
+    std::vector<world_snapshot> snapshots;
+    /** Simulated seconds of burn-in skipped by starting from snapshots since the last reconfigure() */
+    double burn_in_saved;
+    /** Index of the next snapshot saved to this world's file */
+    int next_snapshot;
+
     void update();
+    void update_parallel();
     void reset();
+    void update_trails();
     void run_trials(int trials, double trial_length);
     void run_trial(double trial_length, int trial_id);
     void save_data(int trial_id);
+
+    // Whether the current state is due to be saved
+    bool save_due();
+
+    // Run count burn-ins of burn_in seconds from random poses, and add their final states to this world's snapshots
+    // (appended to its file in sp.snapshot_dir)
+    void save_snapshots(int count, double burn_in);
+
+    // Load this world's snapshots from sp.snapshot_dir, returning how many there are
+    int load_snapshots();
+
+    // This world's file of snapshots in sp.snapshot_dir (worlds differing in any parameter of the dynamics get their own)
+    std::string snapshot_file() const;
+
+    // Move the agents to a snapshot chosen by the trial's key (after a reset, whose goal counters and random streams
+    // the trial keeps), returning the snapshot's burn-in: the time the trial starts at
+    double start_from_snapshot();
 };
 
 
+// Save the state of agents first ... first + sp.num_agents - 1 of a store as rows of simulation data
+// (agent ids are saved relative to first, and mapped to and from store slots by store_slot and slot_agent if given)
+void save_agent_rows(std::ofstream &outfile, const sim_params &sp, int trial_id, double sim_time, const AgentStore &s, int first,
+                     const int *store_slot = nullptr, const int *slot_agent = nullptr);
+
+
 #endif
\ No newline at end of file
@@ -5,8 +5,13 @@
 #include <iostream>
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <limits>
+#include <atomic>
+#include <unordered_map>
 #include "../random.hh"
 #include "../shared_utils.hh"
+#include "kd_tree.hh"
 
 // FLTK Gui includes
 #include <FL/fl_draw.H>
@@ -20,6 +25,7 @@
 
 
 class Agent;
+class WorkerPool;
 
 
 
@@ -34,14 +40,31 @@ typedef struct {
     // meters_t periodic_bounds; /// x and y axis value where periodic bounds are enforced = r_upper
 
     // neighbor search settings
-    meters_t cells_range; // coordinate range covered by cells with side length < sensing range
+    meters_t cells_range; // coordinate range covered by cells with side length < sensing range (unused by hashed cells)
     int cells_per_side; // split the (r_upper)^2 square region into (cells_per_side)^2 cells for tracking agents in
     bool use_sorted_agents, use_cell_lists;
     meters_t cell_width;
+    bool hashed_cell_lists = true; // in non-periodic worlds, create cells wherever agents are instead of covering cells_range with a fixed grid
+    bool incremental_cell_lists = false; // each step, only move agents that changed cell instead of rebuilding the grid
+    bool use_cone_stencil = false; // with cell lists, only search the cells that can overlap an agent's vision cone
+    bool use_verlet_lists = false; // sense from per-agent neighbor lists, rebuilt only after some agent moves more than verlet_skin / 2
+    meters_t verlet_skin = 0.5; // how far beyond sensing_range the Verlet lists reach
+    bool use_kd_tree = false; // sense from a k-d tree, which splits crowded regions finer than the grid (Verlet lists take precedence)
+    int kd_leaf_size = 32; // most agents in a leaf of the k-d tree
+    int kd_rebuild_interval = 10; // steps between k-d tree rebuilds; in between, only its bounding boxes are refit
+    bool event_driven_sensing = false; // with cell lists, agents keep their last sensing result while nothing has moved in the cells they search (same results)
+    int renumber_interval = 0; // steps between renumberings of the agent store along a Morton curve of cells, so neighbors sit close in memory; 0 for never
 
     float dt; // how much to update by during each step
     bool verbose;
 
+    // for parallel stepping
+    int num_threads = 1; // threads used for the sense and move phases of each step; 1 runs the serial loops
+    bool domain_decomposition = false; // in a periodic world with cell lists, give each thread a strip of cell columns and the agents in it
+
+    // for random numbers
+    uint64_t seed = 0; // master seed for the agents' random streams; 0 picks a fresh one (saved with the data either way)
+
     // for agents
     meters_t sensing_range;
     radians_t sensing_angle;
@@ -65,6 +88,7 @@ typedef struct {
     float gui_speedup;
     int gui_zoom;
     bool gui_draw_cells, gui_draw_footprints;
+    int gui_draw_every = 1; // simulation steps per GUI redraw
     bool gui_random_colors;
 
     // for saving data
@@ -72,77 +96,159 @@ typedef struct {
     std::string outfile_name;
     std::string addtl_data; // optional label or additional data to save with this simulation
 
+    // for warm starts
+    std::string snapshot_dir; // folder of equilibrated states to start trials from, one file per world (see SimulationManager::save_snapshots); leave empty to start every trial from random poses
+
 } sim_params;
 
 
+// A period of simulated time as a whole number of steps, so periodic work (saving, footprints, GUI redraws) is
+// scheduled on the integer step counter. Testing the floating point clock with fmod instead drifts over long runs,
+// skipping or doubling triggers.
+struct TickInterval {
+    uint64_t ticks; // steps between triggers, 0 for never
 
-// Cell class
-// Used in cell lists for identifying neighbors
-class Cell {
-    public:
-    Cell(float x_min, float x_max, float y_min, float y_max) {
-        xmin = x_min;
-        xmax = x_max;
-        ymin = y_min;
-        ymax = y_max;
+    TickInterval() : ticks(0) {}
+    explicit TickInterval(uint64_t every_ticks) : ticks(every_ticks) {}
+
+    // The nearest whole number of steps of length dt (at least one) to a positive period, or never
+    static TickInterval from_seconds(double seconds, double dt) {
+        if (!(seconds > 0) || !(dt > 0)) { return TickInterval(); }
+        return TickInterval(std::max<uint64_t>(1, std::llround(seconds / dt)));
     }
 
-    ~Cell(){}
+    // Whether the period comes round at this step
+    bool due(uint64_t step) const { return ticks > 0 && step % ticks == 0; }
+};
 
-    // int row, col; // index cell's position in overall cell vector (although... does the cell need to know this?)
-    float xmin, xmax, ymin, ymax; // bounds of the space enclosed by cell
-    bool is_overflow_cell; // cell outside the given arena bounds
-    bool is_outer_cell; // cell adjacent to the outside of the arena bounds
-    std::vector<Agent *> occupants; // agents in this cell
-    std::vector<Cell *> neighbors; // neighboring cells
+// Steps needed for the clock to reach time seconds, with steps of length dt
+// (tolerating the rounding in seconds / dt, so a whole number of steps is not rounded up to the next one)
+inline uint64_t steps_to_reach(double seconds, double dt) {
+    if (!(seconds > 0)) { return 0; }
+    return (uint64_t)std::ceil(seconds / dt - 1e-6);
+}
 
 
-    // check if a pose is in cell
-    // a cell includes its bottom/left sides and excludes its top/right sides
-    bool in_cell(Pose p) 
-    {
-        bool x_in_cell = (xmin <= p.x && p.x < xmax);
-        bool y_in_cell = (ymin <= p.y && p.y < ymax);
-        return x_in_cell && y_in_cell;
-    }
+typedef struct {
+    int id; // id of sensed neighbor
+    meters_t dist_away;
+} sensor_result;
 
-    // reset cell between trials
-    void reset() {
-        occupants.clear();
-    }
 
-    // add neighbor
-    void add_neighbor(Cell* nbr) {
-        neighbors.push_back(nbr);
+// Agent state stored as a structure of arrays, indexed by agent id
+// Agents read and write their state here, so the sensing and moving loops stream through contiguous memory
+// (stored as real_t, so in single precision in a MINISTAGE_FLOAT32 build)
+class AgentStore {
+    public:
+    // pose
+    std::vector<real_t> x, y;
+    std::vector<real_t> a;
+
+    // current speeds
+    std::vector<real_t> fwd_speed; // meters per second
+    std::vector<real_t> turn_speed; // radians per second
+
+    // goal
+    std::vector<real_t> goal_x, goal_y;
+    std::vector<char> stop; // blocked by a neighbor in the vision cone
+    std::vector<int> goals_reached;
+    std::vector<uint64_t> goal_birth_time;
+
+    // run phases and steering
+    std::vector<real_t> travel_angle; // angle the agent is currently steering towards
+    std::vector<int> phase_count; // time so far spent in the current run phase
+    std::vector<int> runsteps; // total length of the current run phase
+
+    // sensing
+    std::vector<char> sensed_any; // any neighbor in the vision cone at the last sensing update
+    std::vector<std::vector<sensor_result>> sensed; // neighbors in the vision cone, only filled in when sd->record_sensed is set
+
+    // each agent's random stream, see AgentRef::rng()
+    std::vector<Random::Stream> rng;
+
+    int size() const { return x.size(); }
+
+    // Reorder the agents, so that slot k holds what slot order[k] held
+    void permute(const std::vector<int> &order) {
+        auto reorder = [&order](auto &v) {
+            std::remove_reference_t<decltype(v)> moved(v.size());
+            for (size_t k = 0; k < order.size(); k++) { moved[k] = std::move(v[order[k]]); }
+            v.swap(moved);
+        };
+        reorder(x);
+        reorder(y);
+        reorder(a);
+        reorder(fwd_speed);
+        reorder(turn_speed);
+        reorder(goal_x);
+        reorder(goal_y);
+        reorder(stop);
+        reorder(goals_reached);
+        reorder(goal_birth_time);
+        reorder(travel_angle);
+        reorder(phase_count);
+        reorder(runsteps);
+        reorder(sensed_any);
+        reorder(sensed);
+        reorder(rng);
     }
 
-    // draw on canvas
-    void draw() {
-        glBegin(GL_LINE_LOOP);               // Draw outline of cell, with no fill
-        // if (is_outer_cell) {
-        if (false) {
-            glColor4f(0.1, 0.7, 0.2, 0.2);    // Green outline
-        }
-        else {
-            glColor4f(0.0f, 0.9, 0.0f, 0.2);    // different Green outline
-        }
-        
-        glVertex2f(xmin, ymin);              // x, y
-        glVertex2f(xmax, ymin);
-        glVertex2f(xmax, ymax);
-        glVertex2f(xmin, ymax);
-        glEnd();
+    // Exchange the agents in slots i and j
+    void swap_agents(int i, int j) {
+        std::swap(x[i], x[j]);
+        std::swap(y[i], y[j]);
+        std::swap(a[i], a[j]);
+        std::swap(fwd_speed[i], fwd_speed[j]);
+        std::swap(turn_speed[i], turn_speed[j]);
+        std::swap(goal_x[i], goal_x[j]);
+        std::swap(goal_y[i], goal_y[j]);
+        std::swap(stop[i], stop[j]);
+        std::swap(goals_reached[i], goals_reached[j]);
+        std::swap(goal_birth_time[i], goal_birth_time[j]);
+        std::swap(travel_angle[i], travel_angle[j]);
+        std::swap(phase_count[i], phase_count[j]);
+        std::swap(runsteps[i], runsteps[j]);
+        std::swap(sensed_any[i], sensed_any[j]);
+        std::swap(sensed[i], sensed[j]);
+        std::swap(rng[i], rng[j]);
     }
 
-};
+    // allocate (zeroed) state for n agents, reusing the storage already allocated
+    void resize(int n) {
+        x.assign(n, 0);
+        y.assign(n, 0);
+        a.assign(n, 0);
+        fwd_speed.assign(n, 0);
+        turn_speed.assign(n, 0);
+        goal_x.assign(n, 0);
+        goal_y.assign(n, 0);
+        stop.assign(n, 0);
+        goals_reached.assign(n, 0);
+        goal_birth_time.assign(n, 0);
+        travel_angle.assign(n, 0);
+        phase_count.assign(n, 0);
+        runsteps.assign(n, 0);
+        sensed_any.assign(n, 0);
+        sensed.resize(n); // each agent's list keeps its storage from earlier worlds
+        for (std::vector<sensor_result> &list : sensed) { list.clear(); }
+        rng.assign(n, Random::Stream());
+    }
 
+    Pose2 get_pos(int id) const { return Pose2(x[id], y[id], a[id]); }
 
+    void set_pos(int id, const Pose2 &p) {
+        x[id] = p.x;
+        y[id] = p.y;
+        a[id] = p.a;
+    }
 
+    Pose2 get_goal(int id) const { return Pose2(goal_x[id], goal_y[id], 0); }
 
-typedef struct {
-    int id; // id of sensed neighbor
-    meters_t dist_away;
-} sensor_result;
+    void set_goal(int id, const Pose2 &p) {
+        goal_x[id] = p.x;
+        goal_y[id] = p.y;
+    }
+};
 
 /// Simulation Data Class
 // Stores data about simulation time and agent positions
@@ -153,61 +259,456 @@ class SimulationData {
         ~SimulationData();
 
         sim_params *sp;
-        double sim_time;
-
-        /** maintain a vector of agents sorted by pose.x, for quickly finding neighbors */
-        std::vector<Agent *> agents_byx_vec;
-
-        /** maintain a vector of agents sorted by pose.y, for quickly finding neighbors */
-        std::vector<Agent *> agents_byy_vec;
-
-        // 2D vector of cell pointers
-        std::vector<std::vector<Cell *>> cells;
+        double sim_time; // step * dt, never accumulated
+        uint64_t step; // steps since the last reset, the clock that schedules all periodic work
+        uint64_t end_step; // last step of the current trial, whose state is always saved (0 if not known)
+
+        // Periodic work, in steps
+        static constexpr double FOOTPRINT_INTERVAL = 0.5; // seconds between footprints left in the agents' trails
+        TickInterval save_interval; // sp->save_data_interval
+        TickInterval footprint_interval;
+        int trial; // current trial, part of the key for the agents' random streams
+
+        /** state of every agent, indexed by store slot */
+        AgentStore state;
+
+        // Store slots: agent i is in slot i until renumber_agents() moves agents that are close in space next to each
+        // other in the store. Everything inside SimulationData (cells, sorted agents, k-d tree, Verlet lists, sensed
+        // ids) works in slots; agent ids only key the random streams and label the saved data.
+        std::vector<int> slot_agent; // agent id in each slot
+        std::vector<int> agent_store_slot; // slot of each agent id
+
+        /** maintain a vector of agent ids sorted by pose.x, for quickly finding neighbors */
+        std::vector<int> agents_byx_vec;
+
+        // Flat cell grid in compressed sparse row form, rebuilt every step by a counting sort
+        // Cell (idx, idy) has index idx * cells_per_side + idy, where cell 0 is in the bottom left
+        // The occupants of cell c are cell_agents[cell_start[c]] ... cell_agents[cell_end[c] - 1]
+        // (in id order right after a rebuild; incremental updates fill the spare slots up to cell_start[c + 1])
+        int num_cells; // including the overflow cell, if any
+        std::vector<int> cell_start; // offset of each cell's occupants in cell_agents (num_cells + 1 entries)
+        std::vector<int> cell_end; // one past the last occupant of each cell
+        std::vector<int> cell_agents; // agent ids grouped by cell
+        std::vector<real_t> cell_x, cell_y; // positions of the agents in cell_agents, packed alongside them for batched sensing
+        std::vector<int> agent_cell; // cell index of each agent
+        std::vector<int> agent_slot; // position of each agent in cell_agents
+
+        // Hashed cells, used instead of the fixed grid in non-periodic worlds if sp->hashed_cell_lists is set
+        // Cell c covers [ix, ix + 1) * cell_width in x (likewise in y) with no bound on the coordinates,
+        // and only exists if an agent was in it or next to it at the last rehash. There is no overflow cell.
+        struct HashedCell {
+            int ix, iy; // integer coordinates
+            int nbrs[9]; // the cells at offsets -1 ... 1 in x and y ((dx + 1) * 3 + dy + 1), or -1
+        };
+        bool hashed_cells;
+        std::unordered_map<uint64_t, int> cell_index; // packed integer coordinates of each cell -> cell
+        std::vector<HashedCell> hashed_cell_info; // each cell's coordinates and neighbors, in increasing order of coordinates
+        std::vector<uint64_t> agent_cell_key; // packed integer coordinates of each agent's cell, to spot agents changing cell
+        uint64_t cell_rehashes; // times the hashed cells were laid out again since the last reset
+
+        /** k-d tree over agent positions, used for sensing if sp->use_kd_tree is set */
+        KdTree kd_tree;
+
+        // Event driven sensing
+        std::vector<char> cell_changed; // whether any agent moved into, out of or within each cell during the last step
+        std::vector<Pose2> sensed_from; // pose of each agent when it last sensed
+        std::atomic<uint64_t> skipped_senses; // sensing evaluations skipped since the last reset
+
+        // Incremental cell list metrics
+        int last_cell_migrations; // agents that changed cell during the last update
+        uint64_t total_cell_migrations; // agents that changed cell since the last reset
+        uint64_t cell_rebuilds; // full rebuilds since the last reset (including the one at reset)
+
+        // Cone stencil: for each heading sector and position within a cell, the cell offsets that can overlap the vision cone
+        // Offsets for key k are (stencil_dx[j], stencil_dy[j]) for j in [stencil_start[k], stencil_start[k + 1]), nearest cells first
+        static const int STENCIL_HEADING_SECTORS = 32;
+        static const int STENCIL_SUBCELLS = 8; // sub-cells per side of a cell
+        std::vector<int> stencil_start;
+        std::vector<int> stencil_dx, stencil_dy;
+        int stencil_reach; // largest cell offset in the stencil
+        meters_t stencil_range, stencil_cell_width; // parameters the stencil was built for
+        radians_t stencil_angle;
+
+        // Verlet lists: each agent's neighbors within sensing_range + verlet_skin as of the last build
+        // The neighbors of agent i are verlet_nbrs[verlet_start[i]] ... verlet_nbrs[verlet_start[i + 1] - 1]
+        std::vector<int> verlet_start;
+        std::vector<int> verlet_nbrs;
+        std::vector<real_t> verlet_x, verlet_y; // agent positions at the last build
+        meters_t verlet_cutoff; // list radius at the last build
+        uint64_t verlet_builds; // builds since the last reset (including the one at reset)
+        uint64_t verlet_total_length; // list lengths summed over every build since the last reset
+        double verlet_avg_length; // mean list length at the last build
+
+        // Overflow cell for positions outside the range of cells in the grid (always the last cell index)
+        int overflow_cell;
+
+        // Domain decomposition (sp->domain_decomposition): the columns of the periodic cell grid are split into one strip
+        // per thread, and the store is kept laid out strip by strip, so each thread senses and moves the agents of its
+        // own strip, reading the neighboring strips' edge cells in place as its halo. Agents that cross into another
+        // strip migrate to it at the next update.
+        int num_domains; // 1 without domain decomposition
+        std::vector<int> domain_first; // the agents of domain d are in slots domain_first[d] ... domain_first[d + 1] - 1
+        std::vector<int> column_domain; // domain owning each column of cells
+        uint64_t domain_migrations; // agents that moved to another domain since the last reset
 
         // 1D vector of agent pointers
         std::vector <Agent *> agents;
 
-        // Overflow cell for positions outside the range of cells in the vector
-        Cell *overflow_cell;
+        // Optional worker threads used to build the cell grid (owned by SimulationManager)
+        WorkerPool *pool;
 
         void update();
 
         void reset();
 
-        // Find nearby agents to a given position
-        std::vector<Agent *> find_nearby_sorted_agents(Pose *agent_pos);
+        // Size the agent store and search structures for new parameters in *sp (another world of a sweep), keeping the
+        // storage of the old ones. Leaves the data as constructing it for *sp would.
+        void reconfigure();
+
+        // Reorder the agent store along a Morton curve of the agents' cells and rebuild the neighbor search structures
+        // on the new slots, so an agent's neighbors sit near it in memory (done every sp->renumber_interval steps)
+        void renumber_agents();
+
+        // Choose strips of cell columns holding about the same number of agents, one per thread, and lay the store out
+        // strip by strip (done at reset)
+        void partition_domains();
+
+        // Move the agents that crossed into another strip over to its domain
+        void migrate_agents();
+
+        // Column of cells holding x (clamped to the grid), and the domain owning it
+        int column_of(meters_t x) const {
+            int col = (int)floor((x + sp->cells_range) / sp->cell_width);
+            return std::min(std::max(col, 0), sp->cells_per_side - 1);
+        }
+        int domain_of(meters_t x) const { return column_domain[column_of(x)]; }
+
+        // Split the agents into blocks for the worker pool: one per domain with domain decomposition, otherwise equal
+        // blocks of slots (a single block when waking the workers is not worth it)
+        int num_agent_blocks() const;
+        int agent_block_begin(int b, int num_blocks) const;
+
+        // Find ids of nearby agents to a given position
+        std::vector<int> find_nearby_sorted_agents(const Pose2 &agent_pos);
 
-        // Find nearby agents to a given position
-        std::vector<Agent *> find_nearby_cell_lists(Pose *agent_pos);
+        // Find ids of nearby agents to a given position
+        std::vector<int> find_nearby_cell_lists(const Pose2 &agent_pos);
+
+        // Find ids of agents within sensing range of a given position
+        std::vector<int> find_nearby_kd_tree(const Pose2 &agent_pos);
 
         // Return what this agent would sense
-        std::vector <sensor_result> sense(int agent_id, Pose agent_pos);
+        std::vector <sensor_result> sense(int agent_id, Pose2 agent_pos);
+
+        // Return whether this agent would sense anyone, stopping at the first neighbor found
+        bool sense_any(int agent_id, Pose2 agent_pos);
+
+        // Whether this agent's last sensing result still holds (event driven sensing): it has not moved since it last
+        // sensed, and no agent has moved in any of the cells it searches. Never true while sensed lists are recorded
+        bool sense_unchanged(int agent_id, const Pose2 &agent_pos) const;
 
+        // If false, agents only check whether anyone is in their vision cone and leave their sensed lists empty
+        // (SimulationManager turns this on for the steps whose state is saved)
+        bool record_sensed;
+
+        // compare agent ids by position in the agent store
         struct ltx {
-            bool operator()(const Agent *a, const Agent *b) const;
+            const AgentStore *s;
+            bool operator()(int a, int b) const;
         };
 
-        struct lty {
-            bool operator()(const Agent *a, const Agent *b) const;
-        };
+        // Call f(id) for each agent whose x and y are both within sensing_range of agent_pos (measured across the
+        // seams of a periodic world), by sweeping agents_byx_vec over the x window and checking y directly
+        // f returns true to stop the sweep early; the return value says whether it was stopped
+        template <typename F>
+        bool for_each_nearby_sorted_agent(const Pose2 &agent_pos, F f) const {
+            meters_t rng = sp->sensing_range;
+            meters_t span = 2 * sp->r_upper;
+
+            auto y_close = [&](int id) {
+                meters_t dy = fabs(state.y[id] - agent_pos.y);
+                if (sp->periodic) { dy = std::min(dy, span - dy); }
+                return dy <= rng;
+            };
+
+            auto sweep = [&](meters_t xmin, meters_t xmax) {
+                auto it = std::lower_bound(agents_byx_vec.begin(), agents_byx_vec.end(), xmin, 
+                                           [this](int a, meters_t x) { return state.x[a] < x; });
+                for (; it != agents_byx_vec.end() && state.x[*it] <= xmax; ++it) {
+                    if (y_close(*it) && f(*it)) { return true; }
+                }
+                return false;
+            };
+
+            if (!sp->periodic) { return sweep(agent_pos.x - rng, agent_pos.x + rng); }
+
+            // the window covers the whole periodic world
+            meters_t inf = std::numeric_limits<meters_t>::infinity();
+            if (2 * rng >= span) { return sweep(-inf, inf); }
+
+            // otherwise it can reach across at most one of the two seams
+            if (agent_pos.x - rng < -sp->r_upper && sweep(agent_pos.x - rng + span, inf)) { return true; }
+            if (sweep(agent_pos.x - rng, agent_pos.x + rng)) { return true; }
+            return agent_pos.x + rng > sp->r_upper && sweep(-inf, agent_pos.x + rng - span);
+        }
+
+        // Find the index of the cell a position belongs to (-1 for a hashed cell that does not exist)
+        int get_cell_for_pos(meters_t x, meters_t y) const;
+
+        // The cell of agent agent_id at agent_pos: the one it was put in at the last update if it is still there
+        // (saving a hash lookup), otherwise looked up
+        int cell_of(int agent_id, const Pose2 &agent_pos) const {
+            if (hashed_cells && agent_id >= 0 && agent_id < (int)agent_cell.size() && agent_cell[agent_id] < num_cells &&
+                agent_cell_key[agent_id] == hashed_key(agent_pos.x, agent_pos.y)) {
+                return agent_cell[agent_id];
+            }
+            return get_cell_for_pos(agent_pos.x, agent_pos.y);
+        }
+
+        // Integer coordinates of the cell a position belongs to, in the hashed grid
+        int hashed_coord(meters_t v) const {
+            double c = floor(v / sp->cell_width);
+            return (int)std::max(std::min(c, (double)std::numeric_limits<int>::max()), (double)std::numeric_limits<int>::min());
+        }
+
+        // The hashed cell with the given key (or at integer coordinates (idx, idy)), or -1 if it does not exist
+        // (out of line, so the hash lookup does not stop the cell walks from inlining)
+        int hashed_cell(uint64_t key) const;
+        int hashed_cell(int idx, int idy) const { return hashed_cell(cell_key(idx, idy)); }
 
-        // Find which cell a position belongs to
-        Cell* get_cell_for_pos(Pose *p);
+        static uint64_t cell_key(int idx, int idy) { return ((uint64_t)(uint32_t)idx << 32) | (uint32_t)idy; }
+        uint64_t hashed_key(meters_t x, meters_t y) const { return cell_key(hashed_coord(x), hashed_coord(y)); }
 
-        // Create cells and neighbor relations
+        // Grid coordinates of a cell, and the position of the grid's bottom left corner
+        int cell_idx(int cell) const { return hashed_cells ? hashed_cell_info[cell].ix : cell / sp->cells_per_side; }
+        int cell_idy(int cell) const { return hashed_cells ? hashed_cell_info[cell].iy : cell % sp->cells_per_side; }
+        meters_t cell_origin() const { return hashed_cells ? 0 : -sp->cells_range; }
+
+        // Lay out the hashed cells again: the cell of every agent and its eight neighbors, so that agents can cross into
+        // a neighboring cell before the next rehash is needed
+        void rehash_cells();
+
+        // Size the cell grid
         void init_cell_lists();
 
         // Add agents to correct cell lists
         void populate_cell_lists();
 
+        // Move only the agents whose cell changed since the last update, rebuilding if a cell runs out of room
+        void update_cell_lists();
+
+        // Flag the old and new cells of every agent that moved since the cell lists were last updated
+        void mark_changed_cells();
+
+        // Rebuild the k-d tree every kd_rebuild_interval steps, and refit it to the new positions otherwise
+        void update_kd_tree();
+
+        // Rebuild the Verlet lists if some agent has moved more than verlet_skin / 2 since the last build,
+        // or if the list radius changed
+        void update_verlet_lists();
+
+        // Rebuild the Verlet lists from the current positions
+        void build_verlet_lists();
+
+        // Index of the cell offset by (dx, dy) from cell, or -1 if there is no such cell
+        // Offsets past the edge of the grid wrap around if the simulation is periodic
+        int offset_cell(int cell, int dx, int dy) const {
+            if (hashed_cells) {
+                const HashedCell &hc = hashed_cell_info[cell];
+                if (dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1) { return hc.nbrs[(dx + 1) * 3 + dy + 1]; }
+                return hashed_cell(hc.ix + dx, hc.iy + dy);
+            }
+
+            int cps = sp->cells_per_side;
+            int nbr_idx = cell / cps + dx;
+            int nbr_idy = cell % cps + dy;
+
+            if (nbr_idx < 0 || nbr_idx >= cps || nbr_idy < 0 || nbr_idy >= cps) {
+                if (!sp->periodic) { return -1; }
+                nbr_idx = (nbr_idx + cps) % cps;
+                nbr_idy = (nbr_idy + cps) % cps;
+            }
+
+            return nbr_idx * cps + nbr_idy;
+        }
+
+        bool is_outer_cell(int cell) const {
+            if (hashed_cells) { return false; }
+            int cps = sp->cells_per_side;
+            int idx = cell / cps;
+            int idy = cell % cps;
+            return cell != overflow_cell && (idx == 0 || idy == 0 || idx == cps - 1 || idy == cps - 1);
+        }
+
+        // Call f(c) for cell c and then for each of its neighboring cells, found by index arithmetic
+        // Outer cells neighbor the overflow cell, and the overflow cell neighbors every outer cell
+        template <typename F>
+        void for_each_nearby_cell(int cell, F f) const {
+            int cps = sp->cells_per_side;
+            f(cell);
+
+            if (!hashed_cells && cell == overflow_cell) {
+                for_each_outer_cell(f);
+                return;
+            }
+
+            int seen[9] = {cell};
+            int num_seen = 1;
+
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    if (dx == 0 && dy == 0) { continue; }
+
+                    int nbr = offset_cell(cell, dx, dy);
+                    if (nbr < 0) { continue; }
+
+                    // on grids narrower than 3 cells, several offsets wrap onto the same cell
+                    if (!hashed_cells && cps < 3) {
+                        if (std::find(seen, seen + num_seen, nbr) != seen + num_seen) { continue; }
+                        seen[num_seen++] = nbr;
+                    }
+
+                    f(nbr);
+                }
+            }
+
+            if (is_outer_cell(cell)) { f(overflow_cell); }
+        }
+
+        // Same cells as for_each_nearby_cell, but the neighbors are visited in order of how closely
+        // they line up with heading, so the cells in front of an agent come first
+        // f returns true to stop the walk early; the return value says whether the walk was stopped
+        template <typename F>
+        bool for_each_nearby_cell_ahead(int cell, radians_t heading, F f) const {
+            int cps = sp->cells_per_side;
+
+            // the overflow cell and narrow grids have no useful ordering
+            if (!hashed_cells && (cell == overflow_cell || cps < 3)) {
+                bool stopped = false;
+                for_each_nearby_cell(cell, [&](int c) { if (!stopped) { stopped = f(c); } });
+                return stopped;
+            }
+
+            if (f(cell)) { return true; }
+
+            // neighbor k lies in direction k * 45 degrees; start from the one closest to heading and fan out
+            static const int dxs[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+            static const int dys[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+            static const int fan[8] = {0, 1, -1, 2, -2, 3, -3, 4};
+            int octant = (int)std::lround(heading / (M_PI / 4));
+
+            for (int j = 0; j < 8; j++) {
+                int k = ((octant + fan[j]) % 8 + 8) % 8;
+                int nbr = offset_cell(cell, dxs[k], dys[k]);
+                if (nbr >= 0 && f(nbr)) { return true; }
+            }
+
+            return is_outer_cell(cell) && f(overflow_cell);
+        }
+
+        // Visit the cells that can overlap the vision cone of an agent at agent_pos (in cell), using the cone stencil
+        // Falls back to for_each_nearby_cell_ahead where the stencil does not apply
+        // f returns true to stop the walk early; the return value says whether the walk was stopped
+        template <typename F>
+        bool for_each_cone_cell(const Pose2 &agent_pos, int cell, F f) const {
+            int cps = sp->cells_per_side;
+            if (!hashed_cells && (cell == overflow_cell || cps < 2 * stencil_reach + 1)) {
+                return for_each_nearby_cell_ahead(cell, agent_pos.a, f);
+            }
+
+            int key = stencil_key(agent_pos, cell_idx(cell), cell_idy(cell));
+
+            for (int j = stencil_start[key]; j < stencil_start[key + 1]; j++) {
+                int nbr = offset_cell(cell, stencil_dx[j], stencil_dy[j]);
+                if (nbr >= 0 && f(nbr)) { return true; }
+            }
+
+            return is_outer_cell(cell) && f(overflow_cell);
+        }
+
+        // Visit the cells to search for the neighbors of agent agent_id at agent_pos, with the cone stencil if it is enabled
+        template <typename F>
+        bool for_each_candidate_cell(int agent_id, const Pose2 &agent_pos, F f) const {
+            int my_cell = cell_of(agent_id, agent_pos);
+            if (my_cell < 0) { return for_each_hashed_cell_near(agent_pos, sp->sensing_range, f); }
+            if (sp->use_cone_stencil) { return for_each_cone_cell(agent_pos, my_cell, f); }
+            return for_each_nearby_cell_ahead(my_cell, agent_pos.a, f);
+        }
+
+        // Stencil key for an agent at agent_pos in cell (idx, idy)
+        int stencil_key(const Pose2 &agent_pos, int idx, int idy) const {
+            int sector = (int)floor((agent_pos.a + M_PI) / (2 * M_PI / STENCIL_HEADING_SECTORS));
+            sector = (sector % STENCIL_HEADING_SECTORS + STENCIL_HEADING_SECTORS) % STENCIL_HEADING_SECTORS;
+
+            // position within the cell, in units of sub-cells
+            meters_t sub_width = sp->cell_width / STENCIL_SUBCELLS;
+            int subx = (int)floor((agent_pos.x - cell_origin() - idx * sp->cell_width) / sub_width);
+            int suby = (int)floor((agent_pos.y - cell_origin() - idy * sp->cell_width) / sub_width);
+            subx = std::min(std::max(subx, 0), STENCIL_SUBCELLS - 1);
+            suby = std::min(std::max(suby, 0), STENCIL_SUBCELLS - 1);
+
+            return (sector * STENCIL_SUBCELLS + subx) * STENCIL_SUBCELLS + suby;
+        }
+
+        // Rebuild the cone stencil if sensing_range, sensing_angle or cell_width changed since it was built
+        void update_cone_stencil();
+
+        // Visit the hashed cells overlapping the square of side 2 * range around agent_pos
+        // (for positions whose own cell does not exist; every hashed cell is only a lookup away)
+        // f returns true to stop the walk early; the return value says whether the walk was stopped
+        template <typename F>
+        bool for_each_hashed_cell_near(const Pose2 &agent_pos, meters_t range, F f) const {
+            int lo_x = hashed_coord(agent_pos.x - range), hi_x = hashed_coord(agent_pos.x + range);
+            int lo_y = hashed_coord(agent_pos.y - range), hi_y = hashed_coord(agent_pos.y + range);
+            for (int x = lo_x; x <= hi_x; x++) {
+                for (int y = lo_y; y <= hi_y; y++) {
+                    int c = hashed_cell(x, y);
+                    if (c >= 0 && f(c)) { return true; }
+                }
+            }
+            return false;
+        }
+
+        // Call f(c) for each cell on the outside ring of the grid
+        template <typename F>
+        void for_each_outer_cell(F f) const {
+            int cps = sp->cells_per_side;
+            for (int idy = 0; idy < cps; idy++) { f(idy); }
+            if (cps == 1) { return; }
+            for (int idx = 1; idx < cps - 1; idx++) {
+                f(idx * cps);
+                f(idx * cps + cps - 1);
+            }
+            for (int idy = 0; idy < cps; idy++) { f((cps - 1) * cps + idy); }
+        }
+
+        // Draw cell outlines
+        void draw_cells();
+
         // check that the two neighbor-finding implementations agree
-        bool neighbor_functions_agree(int agent_id, Pose agent_pos);
+        bool neighbor_functions_agree(int agent_id, Pose2 agent_pos);
 
-        // check if the byx, byy vecs are properly sorted
+        // check if the byx vec is properly sorted
         bool vecs_sorted();
 
     private:
-        void cell_neighbor_helper(int idx, int idy, int nbr_idx, int nbr_idy);
+        void build_cone_stencil();
+
+        // Lay the store out in a new order, so that slot k holds what slot order[k] held, and rebuild or rename the
+        // neighbor search structures to match
+        void reorder_agents(const std::vector<int> &order);
+
+        // Exchange the agents in slots i and j, along with their places in the cell grid
+        void swap_slots(int i, int j);
+
+        std::vector<std::vector<int>> domain_emigrants; // per-domain agent ids leaving the domain in the current migration
+
+        // Restore the order of agents_byx_vec after agents move, with an insertion sort that falls back to std::sort
+        void sort_agents_byx();
+
+        std::vector<int> cell_counts; // per-thread cell histograms for the counting sort
+        std::vector<std::vector<int>> migrating; // agents that changed cell in the current incremental update, by block
+        std::vector<std::vector<int>> verlet_block_nbrs; // per-thread neighbor lists while building the Verlet lists
 
 };
 
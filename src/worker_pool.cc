@@ -0,0 +1,72 @@
+#include "worker_pool.hh"
+
+// Constructor
+WorkerPool::WorkerPool(int num_threads) 
+    : num_threads(num_threads < 1 ? 1 : num_threads), job(nullptr), job_size(0), generation(0), pending(0), stopping(false)
+{
+    for (int t = 1; t < this->num_threads; t++) {
+        workers.emplace_back(&WorkerPool::worker_loop, this, t);
+    }
+}
+
+// Destructor
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (std::thread &w : workers) { w.join(); }
+}
+
+void WorkerPool::run_chunk(int thread_id) {
+    int begin = (int)((int64_t)job_size * thread_id / num_threads);
+    int end = (int)((int64_t)job_size * (thread_id + 1) / num_threads);
+    if (begin < end) { (*job)(begin, end); }
+}
+
+void WorkerPool::parallel_for(int n, const std::function<void(int, int)> &fn) {
+    // no workers to hand off to, just run the loop here
+    if (workers.empty()) {
+        if (n > 0) { fn(0, n); }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        job = &fn;
+        job_size = n;
+        pending = workers.size();
+        generation++;
+    }
+    start_cv.notify_all();
+
+    // the calling thread handles chunk 0
+    run_chunk(0);
+
+    // wait for the workers to finish their chunks
+    std::unique_lock<std::mutex> lock(mtx);
+    done_cv.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+}
+
+void WorkerPool::worker_loop(int thread_id) {
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            start_cv.wait(lock, [&] { return stopping || generation != seen_generation; });
+            if (stopping) { return; }
+            seen_generation = generation;
+        }
+
+        run_chunk(thread_id);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            pending--;
+            if (pending == 0) { done_cv.notify_one(); }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads for splitting per-agent loops across cores
+// The calling thread takes part in the work, and parallel_for only returns once every chunk is done,
+// so two consecutive calls are separated by a barrier
+class WorkerPool {
+    public:
+    // Constructor: num_threads counts the calling thread, so num_threads - 1 workers are spawned
+    WorkerPool(int num_threads);
+
+    // Destructor: wakes and joins all workers
+    ~WorkerPool();
+
+    int num_threads;
+
+    // Split [0, n) into num_threads contiguous chunks and run fn(begin, end) on each of them
+    void parallel_for(int n, const std::function<void(int, int)> &fn);
+
+    private:
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable start_cv; // signals workers that a new job is available
+    std::condition_variable done_cv; // signals the caller that all workers finished
+    const std::function<void(int, int)> *job;
+    int job_size;
+    uint64_t generation; // incremented once per job so workers can tell new jobs from spurious wakeups
+    int pending; // workers still running the current job
+    bool stopping;
+
+    void worker_loop(int thread_id);
+
+    // run the chunk of the current job belonging to thread_id
+    void run_chunk(int thread_id);
+};
+
+#endif